@@ -0,0 +1,632 @@
+// Benchmarks for pattern.h
+//
+// Usage: bench [--latency] [--flush] [--working-set MB] [--iters N] [--rdtsc]
+//              [--size BYTES] [--seed N] [--corpus KIND] [--startup [N]] [--threads N]
+//              [--set [N]] [--glob] [filter]
+//
+// By default every case is run in a loop and the throughput is reported, then all the matches
+// are scanned from corpora of `--size` bytes generated from `--seed` (see corpus.h). With
+// `--latency` each call is timed on its own and the p50/p99/p99.9 latencies are reported per case
+// and engine, which exposes per-call setup costs (`pattern_init`, pattern analysis) hidden by
+// throughput numbers. Between timed calls `--flush` evicts the caches by writing a large buffer,
+// and `--working-set` rotates through copies of the input spread over MB megabytes of memory.
+// `--corpus` writes a corpus to stdout instead of running the benchmarks.
+// `--startup` measures the cost of compiling 1k/10k/100k generated patterns (or N), split by pass,
+// and of compiling them into a set with `--threads` threads (1 by default).
+// `--set` classifies access log lines with sets of 10/100/1k rarely matching rules (or N) followed
+// by a few frequent ones, with `pattern_set_match` then with `pattern_set_match_any`.
+// `--glob` filters generated file paths with globs, then with their translations to Lua patterns.
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define BENCH_HAS_RDTSC
+#endif
+
+#define PATTERN_IMPLEMENTATION
+#include "../pattern.h"
+#include "corpus.h"
+
+#define BENCH_FLUSH_SIZE (64u << 20)
+#define BENCH_LINE_SIZE  64
+#define BENCH_STARTUP_PATTERN 256
+
+typedef struct {
+    const char* name;
+    const char* pattern;
+    const char* data;
+} Bench_Case;
+
+static const Bench_Case bench_cases[] = {
+    {"literal", "GET", "127.0.0.1 - - [10/Oct/2024:13:55:36 +0000] \"GET /index.html HTTP/1.1\""},
+    {"anchored", "^(%d+)%.(%d+)%.(%d+)%.(%d+)", "192.168.100.254 - frank [10/Oct/2024] \"POST\""},
+    {"end_anchored", "(.-)%.json$", "/var/lib/service/state/cluster/members/node-0042.json"},
+    {"key_value", "(%w+)=(%w+)", "ts=1712345678 level=info msg=started component=scheduler"},
+    {"trim", "^%s*(.-)%s*$", "        some text surrounded by whitespace                    "},
+    {"fixed_length", "%d%d%d%d%-%d%d%-%d%d", "Oct 10 13:55:36 host kernel: date=2024-10-10 ok"},
+    {"backreference", "(%w%w%w%w).-%1", "lorem ipsum dolor sit amet, consectetur adipiscing lorem"},
+    {"balanced", "%b()", "call(first, nested(second, third), fourth) trailing text"},
+    {"no_match", "%d%d%d%d%d%d%d%d", "no long numbers anywhere in this line of text, 12345 only"},
+    // Short subjects and patterns without fast path, where the one-shot setup cost stands out
+    {"short_words", "(%w+) (%w+)", "the quick brown fox jumps over a lazy dog"},
+    {"short_csv", "[^,]+,([^,]+),", "alpha,beta,gamma,delta,epsilon,zeta,eta"},
+};
+
+// Corpora scanned for all the matches of a pattern
+typedef struct {
+    const char* name;
+    const char* pattern;
+    Corpus_Kind corpus;
+} Bench_Scan;
+
+static const Bench_Scan bench_scans[] = {
+    {"scan_status", "\" ([45]%d%d) ", CORPUS_ACCESS_LOG},
+    {"scan_ipv4", "%f[%d](%d+)%.(%d+)%.(%d+)%.(%d+)", CORPUS_ACCESS_LOG},
+    {"scan_syslog", "(%a+) +(%d+) ([%d:]+) (%S+) (%w+)%[(%d+)%]:", CORPUS_SYSLOG},
+    {"scan_csv", "[^,\n]*", CORPUS_CSV},
+    {"scan_jsonl", "\"(%w+)\":", CORPUS_JSONL},
+    {"scan_code", "[%a_][%w_]*", CORPUS_CODE},
+    {"scan_binary", "%z%z%z%z", CORPUS_BINARY},
+    {"scan_adversarial", "a.-b", CORPUS_ADVERSARIAL},
+};
+
+typedef struct {
+    const char* name;
+    const char* pattern;
+    Pattern_Program prog;
+} Bench_Input;
+
+typedef Pattern_Status (*Bench_Engine_Fn)(const Bench_Input* in, Pattern_State* ps,
+                                          const char* data, size_t len, ptrdiff_t start);
+
+typedef struct {
+    const char* name;
+    Bench_Engine_Fn match;
+} Bench_Engine;
+
+// Matches with the one-shot API, parsing the pattern on every call
+static Pattern_Status bench_match(const Bench_Input* in, Pattern_State* ps, const char* data,
+                                  size_t len, ptrdiff_t start) {
+    return pattern_match_ex(ps, data, len, in->pattern, start);
+}
+
+static Pattern_Status bench_match_program(const Bench_Input* in, Pattern_State* ps,
+                                          const char* data, size_t len, ptrdiff_t start) {
+    return pattern_match_program_ex(ps, &in->prog, data, len, start);
+}
+
+static Pattern_Status bench_compile_and_match(const Bench_Input* in, Pattern_State* ps,
+                                              const char* data, size_t len, ptrdiff_t start) {
+    Pattern_Program prog;
+    pattern_compile(&prog, in->pattern);
+    return pattern_match_program_ex(ps, &prog, data, len, start);
+}
+
+static const Bench_Engine bench_engines[] = {
+    {"match", bench_match},
+    {"program", bench_match_program},
+    {"compile+match", bench_compile_and_match},
+};
+
+typedef struct {
+    bool latency;
+    bool flush;
+    bool rdtsc;
+    size_t working_set;
+    size_t iters;
+    size_t size;
+    uint64_t seed;
+    const char* corpus;
+    bool startup;
+    size_t threads;
+    bool set;
+    bool glob;
+    size_t patterns;
+    const char* filter;
+} Bench_Options;
+
+static volatile unsigned bench_sink;
+
+static uint64_t bench_now(bool rdtsc) {
+#ifdef BENCH_HAS_RDTSC
+    if(rdtsc) return __rdtsc();
+#else
+    (void)rdtsc;
+#endif
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_flush(unsigned char* buf) {
+    for(size_t i = 0; i < BENCH_FLUSH_SIZE; i += BENCH_LINE_SIZE) buf[i]++;
+    bench_sink += buf[BENCH_FLUSH_SIZE / 2];
+}
+
+static int bench_cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t bench_percentile(const uint64_t* sorted, size_t n, double p) {
+    return sorted[(size_t)(p * (double)(n - 1) + 0.5)];
+}
+
+static void bench_latency(const Bench_Options* opts, const Bench_Input* in, const char* input,
+                          const Bench_Engine* e, unsigned char* flush_buf, char* copies,
+                          size_t copy_count, uint64_t* samples) {
+    size_t len = strlen(input);
+    size_t stride = (len + BENCH_LINE_SIZE) / BENCH_LINE_SIZE * BENCH_LINE_SIZE;
+    for(size_t i = 0; i < opts->iters; i++) {
+        Pattern_State ps;
+        const char* data = input;
+        if(copy_count) data = copies + (i % copy_count) * stride;
+        if(flush_buf) bench_flush(flush_buf);
+        uint64_t start = bench_now(opts->rdtsc);
+        Pattern_Status status = e->match(in, &ps, data, len, 0);
+        samples[i] = bench_now(opts->rdtsc) - start;
+        bench_sink += status;
+    }
+
+    qsort(samples, opts->iters, sizeof(*samples), bench_cmp_u64);
+    printf("%-18s %-14s %10llu %10llu %10llu %10llu %10llu\n", in->name, e->name,
+           (unsigned long long)samples[0],
+           (unsigned long long)bench_percentile(samples, opts->iters, 0.5),
+           (unsigned long long)bench_percentile(samples, opts->iters, 0.99),
+           (unsigned long long)bench_percentile(samples, opts->iters, 0.999),
+           (unsigned long long)samples[opts->iters - 1]);
+}
+
+static void bench_report(const Bench_Input* in, const Bench_Engine* e, uint64_t start,
+                         size_t calls, size_t bytes) {
+    double secs = (double)(bench_now(false) - start) / 1e9;
+    printf("%-18s %-14s %12.1f %10.1f\n", in->name, e->name, (double)calls / secs / 1e3,
+           (double)bytes / secs / (1 << 20));
+}
+
+static void bench_throughput(const Bench_Options* opts, const Bench_Input* in, const char* input,
+                             const Bench_Engine* e) {
+    size_t len = strlen(input);
+    uint64_t start = bench_now(false);
+    for(size_t i = 0; i < opts->iters; i++) {
+        Pattern_State ps;
+        bench_sink += e->match(in, &ps, input, len, 0);
+    }
+    bench_report(in, e, start, opts->iters, opts->iters * len);
+}
+
+// Finds all the matches in `data`, like Lua's `string.gmatch`
+static void bench_scan(const Bench_Input* in, const char* data, size_t len,
+                       const Bench_Engine* e) {
+    size_t calls = 0, pos = 0;
+    uint64_t start = bench_now(false);
+    while(pos <= len) {
+        Pattern_State ps;
+        calls++;
+        if(e->match(in, &ps, data, len, pos) != PATTERN_MATCH) break;
+        size_t end = ps.captures[0].data - data + ps.captures[0].size;
+        pos = end > pos ? end : pos + 1;
+    }
+    bench_sink += calls;
+    bench_report(in, e, start, calls, len);
+}
+
+static int bench_dump_corpus(const Bench_Options* opts) {
+    for(int kind = 0; kind < CORPUS_KIND_COUNT; kind++) {
+        if(strcmp(opts->corpus, corpus_kind_names[kind])) continue;
+        char* data = malloc(opts->size);
+        if(!data) return EXIT_FAILURE;
+        corpus_generate((Corpus_Kind)kind, opts->seed, data, opts->size);
+        fwrite(data, 1, opts->size, stdout);
+        free(data);
+        return EXIT_SUCCESS;
+    }
+    fprintf(stderr, "unknown corpus '%s', expected one of:", opts->corpus);
+    for(int kind = 0; kind < CORPUS_KIND_COUNT; kind++) {
+        fprintf(stderr, " %s", corpus_kind_names[kind]);
+    }
+    fprintf(stderr, "\n");
+    return EXIT_FAILURE;
+}
+
+// Pieces of the patterns generated by `bench_pattern`, as found in log processing rules
+static const char* const bench_pattern_items[] = {
+    "%d+",      "(%d+)",        "(%w+)",         "%s*",        "%s+",    "[%w_]+", "[%a_][%w_]*",
+    "(.-)",     "[^,]*",        "%b()",          "%f[%w]",     "=",      "%.",     ":",
+    "%[(%d+)%]", "\"([^\"]*)\"", "[45]%d%d",      "(%x+)",      "%-?%d+", "%S+",    ".",
+    "%d%d%d%d%-%d%d%-%d%d",     "(%d+)%.(%d+)%.(%d+)%.(%d+)",  "%d%d:%d%d:%d%d",
+};
+
+// Writes a pattern made of a few literal words and items to `out`, NUL terminated
+static void bench_pattern(Corpus_Rng* rng, char* out, size_t size) {
+    size_t n = 0;
+    if(corpus_below(rng, 4) == 0) n += snprintf(out + n, size - n, "^");
+    unsigned items = 1 + corpus_below(rng, 5);
+    for(unsigned i = 0; i < items && n < size; i++) {
+        const char* item = corpus_below(rng, 3) ? corpus_pick(rng, bench_pattern_items)
+                                                : corpus_pick(rng, corpus_words);
+        n += snprintf(out + n, size - n, "%s", item);
+    }
+    if(n < size && corpus_below(rng, 4) == 0) snprintf(out + n, size - n, "$");
+}
+
+typedef struct {
+    const Pattern_Set* set;
+    const char* const* patterns;
+    size_t begin, end;
+} Bench_Compile_Range;
+
+static void* bench_compile_range(void* arg) {
+    const Bench_Compile_Range* range = arg;
+    pattern_set_compile_range(range->set, range->patterns, 0, range->begin, range->end);
+    return NULL;
+}
+
+// Compiles the patterns into `set` with `threads` threads, each compiling a contiguous range
+static bool bench_compile_set(Pattern_Set* set, const char* const* patterns, size_t count,
+                              size_t threads) {
+    pthread_t ids[64];
+    Bench_Compile_Range ranges[64];
+    if(threads > 64) threads = 64;
+    size_t started = 0;
+    for(size_t t = 0; t < threads; t++) {
+        ranges[t] = (Bench_Compile_Range){set, patterns, count * t / threads,
+                                          count * (t + 1) / threads};
+        if(t == 0) continue;  // Compiled by this thread
+        if(pthread_create(&ids[t], NULL, bench_compile_range, &ranges[t])) break;
+        started++;
+    }
+    bench_compile_range(&ranges[0]);
+    for(size_t t = 1; t <= started; t++) pthread_join(ids[t], NULL);
+    return started == threads - 1 && pattern_set_commit(set, count) == 0;
+}
+
+// Compiles `count` patterns one pass at a time, calling the passes of `pattern_compile` directly
+static bool bench_startup_run(const Bench_Options* opts, size_t count) {
+    size_t text_size = 0;
+    char* text = malloc(count * BENCH_STARTUP_PATTERN);
+    const char** patterns = malloc(count * sizeof(*patterns));
+    Pattern_Program* progs = malloc(count * sizeof(*progs));
+    Pattern_Set_Entry* entries = malloc(count * sizeof(*entries));
+    size_t* order = malloc(count * sizeof(*order));
+    if(!text || !patterns || !progs || !entries || !order) return false;
+
+    Corpus_Rng rng = {opts->seed};
+    for(size_t i = 0; i < count; i++) {
+        patterns[i] = text + text_size;
+        bench_pattern(&rng, text + text_size, BENCH_STARTUP_PATTERN);
+        text_size += strlen(patterns[i]) + 1;
+    }
+
+    uint64_t t0 = bench_now(false);
+    for(size_t i = 0; i < count; i++) pattern_analyze(&progs[i], patterns[i], 0);
+    uint64_t t1 = bench_now(false);
+    for(size_t i = 0; i < count; i++) pattern_compile_fixed(&progs[i]);
+    uint64_t t2 = bench_now(false);
+    for(size_t i = 0; i < count; i++) pattern_compile_first_bytes(&progs[i]);
+    uint64_t t3 = bench_now(false);
+    for(size_t i = 0; i < count; i++) progs[i].fingerprint = pattern_fingerprint(patterns[i]);
+    uint64_t t4 = bench_now(false);
+    for(size_t i = 0; i < count; i++) pattern_compile(&progs[i], patterns[i]);
+    uint64_t t5 = bench_now(false);
+    Pattern_Set set;
+    pattern_set_init(&set, entries, order, count);
+    if(!bench_compile_set(&set, patterns, count, opts->threads)) return false;
+    uint64_t t6 = bench_now(false);
+
+    // The set doesn't depend on how its compilation was split
+    for(size_t i = 0; i < count; i++) {
+        if(entries[i].prog.fingerprint != progs[i].fingerprint) {
+            fprintf(stderr, "pattern %zu differs once compiled in a set\n", i);
+            return false;
+        }
+    }
+
+    size_t fixed = 0, idioms = 0, well_formed = 0;
+    for(size_t i = 0; i < count; i++) {
+        fixed += progs[i].fixed_len != 0;
+        idioms += progs[i].idiom != PATTERN_IDIOM_NONE;
+        well_formed += progs[i].well_formed;
+    }
+
+    char set_pass[32];
+    snprintf(set_pass, sizeof(set_pass), "set, %zu thread%s", opts->threads,
+             opts->threads > 1 ? "s" : "");
+    const char* passes[] = {"analyze",     "fixed_sets",      "first_bytes",
+                            "fingerprint", "pattern_compile", set_pass};
+    uint64_t times[] = {t1 - t0, t2 - t1, t3 - t2, t4 - t3, t5 - t4, t6 - t5};
+    for(int p = 0; p < 6; p++) {
+        printf("%-9zu %-16s %12.3f %12.1f\n", count, passes[p], (double)times[p] / 1e6,
+               (double)times[p] / (double)count);
+    }
+    printf("%-9zu %-16s %zu bytes of programs, %zu of pattern text\n", count, "memory",
+           count * sizeof(*progs), text_size);
+    printf("%-9zu %-16s %zu well formed, %zu fixed-length, %zu idioms\n\n", count, "programs",
+           well_formed, fixed, idioms);
+
+    bench_sink += (unsigned)progs[count - 1].fingerprint;
+    free(order);
+    free(entries);
+    free(progs);
+    free(patterns);
+    free(text);
+    return true;
+}
+
+static int bench_startup(const Bench_Options* opts) {
+    printf("%-9s %-16s %12s %12s\n", "patterns", "pass", "total ms", "ns/pattern");
+    if(opts->patterns) return bench_startup_run(opts, opts->patterns) ? 0 : EXIT_FAILURE;
+    for(size_t count = 1000; count <= 100000; count *= 10) {
+        if(!bench_startup_run(opts, count)) return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Classifier rules placed after the generated ones: they can't match the same line, and one of
+// them matches almost every line
+static const char* const bench_set_rules[] = {"\" 2%d%d ", "\" 3%d%d ", "\" 4%d%d ", "\" 5%d%d "};
+
+static size_t bench_set_pass(Pattern_Set* set, bool any, const char* data, size_t len,
+                             uint64_t* checksum) {
+    Pattern_State ps;
+    size_t matches = 0, winner;
+    for(size_t pos = 0; pos < len;) {
+        const char* line = data + pos;
+        const char* newline = memchr(line, '\n', len - pos);
+        size_t line_len = newline ? (size_t)(newline - line) : len - pos;
+        Pattern_Status status = any ? pattern_set_match_any(set, &ps, line, line_len, &winner)
+                                    : pattern_set_match(set, &ps, line, line_len, &winner);
+        if(status == PATTERN_MATCH) {
+            matches++;
+            *checksum = *checksum * 31 + winner;
+        }
+        pos += line_len + 1;
+    }
+    return matches;
+}
+
+// The generated rules are made rare by a prefix that never appears in the access log
+static bool bench_set_run(const Bench_Options* opts, const char* data, size_t len, size_t count) {
+    size_t rules = count + sizeof(bench_set_rules) / sizeof(*bench_set_rules);
+    char* text = malloc(count * BENCH_STARTUP_PATTERN);
+    Pattern_Set_Entry* entries = malloc(rules * sizeof(*entries));
+    size_t* order = malloc(rules * sizeof(*order));
+    if(!text || !entries || !order) return false;
+
+    Pattern_Set set;
+    pattern_set_init(&set, entries, order, rules);
+    Corpus_Rng rng = {opts->seed};
+    for(size_t i = 0; i < count; i++) {
+        char* rule = text + i * BENCH_STARTUP_PATTERN;
+        int prefix = snprintf(rule, BENCH_STARTUP_PATTERN, "#rule%zu ", i);
+        bench_pattern(&rng, rule + prefix, BENCH_STARTUP_PATTERN - prefix);
+        pattern_set_add(&set, rule, 0);
+    }
+    for(size_t i = 0; i < rules - count; i++) pattern_set_add(&set, bench_set_rules[i], 0);
+
+    // Declaration order, which also learns the order used by `pattern_set_match_any`
+    uint64_t declared_sum = 0, learned_sum = 0;
+    uint64_t t0 = bench_now(false);
+    size_t matches = bench_set_pass(&set, false, data, len, &declared_sum);
+    uint64_t t1 = bench_now(false);
+    size_t any_matches = bench_set_pass(&set, true, data, len, &learned_sum);
+    uint64_t t2 = bench_now(false);
+
+    double mib = (double)len / (1 << 20);
+    printf("%-9zu %-16s %12.1f %10zu\n", rules, "pattern_set_match", mib / ((t1 - t0) / 1e9),
+           matches);
+    printf("%-9zu %-16s %12.1f %10zu%s\n", rules, "_match_any", mib / ((t2 - t1) / 1e9),
+           any_matches, learned_sum != declared_sum ? " (winners differ)" : "");
+
+    free(order);
+    free(entries);
+    free(text);
+    return true;
+}
+
+static int bench_set(const Bench_Options* opts) {
+    char* data = malloc(opts->size);
+    if(!data) return EXIT_FAILURE;
+    corpus_generate(CORPUS_ACCESS_LOG, opts->seed, data, opts->size);
+
+    bool ok = true;
+    printf("%-9s %-16s %12s %10s\n", "rules", "function", "MiB/s", "matches");
+    if(opts->patterns) {
+        ok = bench_set_run(opts, data, opts->size, opts->patterns);
+    } else {
+        for(size_t count = 10; count <= 1000 && ok; count *= 10) {
+            ok = bench_set_run(opts, data, opts->size, count);
+        }
+    }
+    free(data);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Globs with the Lua patterns they translate to, `*` becoming `.-`
+typedef struct {
+    const char* glob;
+    const char* pattern;
+} Bench_Glob;
+
+static const Bench_Glob bench_globs[] = {
+    {"*.log.[0-9]*", "^.-%.log%.[0-9].-$"},
+    {"/srv/*/cache/*.tmp", "^/srv/.-/cache/.-%.tmp$"},
+    {"*session*", "^.-session.-$"},
+    {"*/*/*/*/*.json", "^.-/.-/.-/.-/.-%.json$"},
+};
+
+static bool bench_count_line(void* userdata, size_t line, const Pattern_State* ps) {
+    (void)line;
+    (void)ps;
+    (*(size_t*)userdata)++;
+    return true;
+}
+
+// Returns the throughput in MiB/s of matching every line of `data`
+static double bench_glob_pass(const Pattern_Program* prog, const char* data, size_t len,
+                              size_t* matches) {
+    Pattern_State ps;
+    *matches = 0;
+    uint64_t start = bench_now(false);
+    pattern_match_lines(&ps, prog, data, len, 1, bench_count_line, matches);
+    return (double)len / (1 << 20) / ((bench_now(false) - start) / 1e9);
+}
+
+static int bench_glob(const Bench_Options* opts) {
+    char* data = malloc(opts->size);
+    if(!data) return EXIT_FAILURE;
+    corpus_generate(CORPUS_PATHS, opts->seed, data, opts->size);
+
+    bool ok = true;
+    printf("%-20s %-26s %12s %12s %10s\n", "glob", "pattern", "glob MiB/s", "Lua MiB/s",
+           "matches");
+    for(size_t g = 0; g < sizeof(bench_globs) / sizeof(*bench_globs); g++) {
+        Pattern_Program glob, lua;
+        pattern_compile_ex(&glob, bench_globs[g].glob, PATTERN_GLOB);
+        pattern_compile(&lua, bench_globs[g].pattern);
+        size_t glob_matches, lua_matches;
+        double glob_speed = bench_glob_pass(&glob, data, opts->size, &glob_matches);
+        double lua_speed = bench_glob_pass(&lua, data, opts->size, &lua_matches);
+        printf("%-20s %-26s %12.1f %12.1f %10zu\n", bench_globs[g].glob, bench_globs[g].pattern,
+               glob_speed, lua_speed, glob_matches);
+        if(glob_matches != lua_matches) {
+            fprintf(stderr, "%s matched %zu lines, %zu for its translation\n",
+                    bench_globs[g].glob, glob_matches, lua_matches);
+            ok = false;
+        }
+    }
+    free(data);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void bench_usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [--latency] [--flush] [--working-set MB] [--iters N] [--rdtsc]\n"
+            "       [--size BYTES] [--seed N] [--corpus KIND] [--startup [N]] [--threads N]\n"
+            "       [--set [N]] [--glob] [filter]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+    Bench_Options opts = {0};
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--latency")) {
+            opts.latency = true;
+        } else if(!strcmp(argv[i], "--flush")) {
+            opts.flush = true;
+        } else if(!strcmp(argv[i], "--rdtsc")) {
+            opts.rdtsc = true;
+        } else if(!strcmp(argv[i], "--glob")) {
+            opts.glob = true;
+        } else if(!strcmp(argv[i], "--working-set") && i + 1 < argc) {
+            opts.working_set = strtoul(argv[++i], NULL, 10) << 20;
+        } else if(!strcmp(argv[i], "--iters") && i + 1 < argc) {
+            opts.iters = strtoul(argv[++i], NULL, 10);
+        } else if(!strcmp(argv[i], "--size") && i + 1 < argc) {
+            opts.size = strtoul(argv[++i], NULL, 10);
+        } else if(!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            opts.seed = strtoull(argv[++i], NULL, 10);
+        } else if(!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            opts.threads = strtoul(argv[++i], NULL, 10);
+        } else if(!strcmp(argv[i], "--corpus") && i + 1 < argc) {
+            opts.corpus = argv[++i];
+        } else if(!strcmp(argv[i], "--startup") || !strcmp(argv[i], "--set")) {
+            opts.startup = !strcmp(argv[i], "--startup");
+            opts.set = !opts.startup;
+            if(i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9') {
+                opts.patterns = strtoul(argv[++i], NULL, 10);
+            }
+        } else if(argv[i][0] != '-' && !opts.filter) {
+            opts.filter = argv[i];
+        } else {
+            bench_usage(argv[0]);
+        }
+    }
+#ifndef BENCH_HAS_RDTSC
+    if(opts.rdtsc) {
+        fprintf(stderr, "rdtsc is not available on this platform\n");
+        return EXIT_FAILURE;
+    }
+#endif
+    if(opts.flush || opts.working_set) opts.latency = true;
+    if(opts.iters == 0) opts.iters = opts.latency ? 10000 : 1000000;
+    if(opts.size == 0) opts.size = 4u << 20;
+    if(opts.threads == 0) opts.threads = 1;
+
+    if(opts.corpus) return bench_dump_corpus(&opts);
+    if(opts.startup) return bench_startup(&opts);
+    if(opts.set) return bench_set(&opts);
+    if(opts.glob) return bench_glob(&opts);
+
+    unsigned char* flush_buf = NULL;
+    if(opts.flush && !(flush_buf = calloc(BENCH_FLUSH_SIZE, 1))) return EXIT_FAILURE;
+    uint64_t* samples = NULL;
+    if(opts.latency && !(samples = malloc(opts.iters * sizeof(*samples)))) return EXIT_FAILURE;
+
+    if(opts.latency) {
+        printf("%-18s %-14s %10s %10s %10s %10s %10s  (%s)\n", "case", "engine", "min", "p50",
+               "p99", "p99.9", "max", opts.rdtsc ? "cycles" : "ns");
+    } else {
+        printf("%-18s %-14s %12s %10s\n", "case", "engine", "Kcalls/s", "MiB/s");
+    }
+
+    for(size_t c = 0; c < sizeof(bench_cases) / sizeof(*bench_cases); c++) {
+        const Bench_Case* bench = &bench_cases[c];
+        if(opts.filter && !strstr(bench->name, opts.filter)) continue;
+        Bench_Input in;
+        in.name = bench->name;
+        in.pattern = bench->pattern;
+        pattern_compile(&in.prog, in.pattern);
+
+        // Copies of the input, each on its own cache lines, spread over the working set
+        char* copies = NULL;
+        size_t copy_count = 0;
+        if(opts.working_set) {
+            size_t len = strlen(bench->data);
+            size_t stride = (len + BENCH_LINE_SIZE) / BENCH_LINE_SIZE * BENCH_LINE_SIZE;
+            copy_count = opts.working_set / stride + 1;
+            if(!(copies = malloc(copy_count * stride))) return EXIT_FAILURE;
+            for(size_t i = 0; i < copy_count; i++) memcpy(copies + i * stride, bench->data, len);
+        }
+
+        for(size_t e = 0; e < sizeof(bench_engines) / sizeof(*bench_engines); e++) {
+            if(opts.latency) {
+                bench_latency(&opts, &in, bench->data, &bench_engines[e], flush_buf, copies,
+                              copy_count, samples);
+            } else {
+                bench_throughput(&opts, &in, bench->data, &bench_engines[e]);
+            }
+        }
+        free(copies);
+    }
+
+    if(!opts.latency) {
+        char* data = malloc(opts.size);
+        if(!data) return EXIT_FAILURE;
+        for(size_t c = 0; c < sizeof(bench_scans) / sizeof(*bench_scans); c++) {
+            const Bench_Scan* scan = &bench_scans[c];
+            if(opts.filter && !strstr(scan->name, opts.filter)) continue;
+            Bench_Input in;
+            in.name = scan->name;
+            in.pattern = scan->pattern;
+            pattern_compile(&in.prog, in.pattern);
+            corpus_generate(scan->corpus, opts.seed, data, opts.size);
+            // Compiling on every call is the same as `match` with a higher constant, skip it
+            for(size_t e = 0; e < 2; e++) bench_scan(&in, data, opts.size, &bench_engines[e]);
+        }
+        free(data);
+    }
+
+    free(samples);
+    free(flush_buf);
+    return EXIT_SUCCESS;
+}
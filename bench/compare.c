@@ -0,0 +1,262 @@
+// Compares pattern.h with the regex engines found on the build machine
+//
+// Usage: compare [--size BYTES] [--seed N] [filter]
+//
+// Every case is a Lua pattern and an equivalent regular expression, scanned for all the matches
+// in a corpus (see corpus.h). PCRE2 (interpreter and JIT) and RE2 are included when `make compare`
+// finds them with pkg-config, otherwise they are skipped. Throughput is reported per case and
+// engine, relative to pattern.h, then as a geometric mean per pattern category.
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef BENCH_HAVE_PCRE2
+    #define PCRE2_CODE_UNIT_WIDTH 8
+    #include <pcre2.h>
+#endif
+
+#define PATTERN_IMPLEMENTATION
+#include "../pattern.h"
+#include "corpus.h"
+
+typedef struct {
+    const char* category;
+    const char* name;
+    const char* pattern;
+    const char* regex;  // `.` matches newlines in Lua patterns, hence `(?s)`
+    Corpus_Kind corpus;
+} Compare_Case;
+
+static const Compare_Case compare_cases[] = {
+    {"literal", "method", "POST", "POST", CORPUS_ACCESS_LOG},
+    {"literal", "keyword", "return", "return", CORPUS_CODE},
+    {"class", "numbers", "%d+", "[0-9]+", CORPUS_CSV},
+    {"class", "identifiers", "[%a_][%w_]*", "[A-Za-z_][A-Za-z0-9_]*", CORPUS_CODE},
+    {"captures", "status", "\" ([45]%d%d) ", "\" ([45][0-9][0-9]) ", CORPUS_ACCESS_LOG},
+    {"captures", "ipv4", "(%d+)%.(%d+)%.(%d+)%.(%d+)",
+     "([0-9]+)\\.([0-9]+)\\.([0-9]+)\\.([0-9]+)", CORPUS_ACCESS_LOG},
+    {"captures", "syslog", "(%a+) +(%d+) ([%d:]+) (%S+) (%w+)%[(%d+)%]:",
+     "([A-Za-z]+) +([0-9]+) ([0-9:]+) (\\S+) ([A-Za-z0-9]+)\\[([0-9]+)\\]:", CORPUS_SYSLOG},
+    {"captures", "json_keys", "\"(%w+)\":", "\"([A-Za-z0-9]+)\":", CORPUS_JSONL},
+    {"lazy", "json_strings", "\"(.-)\"", "(?s)\"(.*?)\"", CORPUS_JSONL},
+    {"lazy", "comments", "//(.-)\n", "(?s)//(.*?)\\n", CORPUS_CODE},
+    {"binary", "nul_runs", "%z%z%z%z", "\\x00\\x00\\x00\\x00", CORPUS_BINARY},
+    {"adversarial", "near_miss", "a.-b", "(?s)a.*?b", CORPUS_ADVERSARIAL},
+};
+
+typedef struct {
+    const char* name;
+    void* (*compile)(const Compare_Case* c);
+    size_t (*scan)(void* prog, const char* data, size_t len);
+    void (*free)(void* prog);
+} Compare_Engine;
+
+static void* compare_pattern_compile(const Compare_Case* c) {
+    Pattern_Program* prog = malloc(sizeof(*prog));
+    if(prog) pattern_compile(prog, c->pattern);
+    return prog;
+}
+
+static size_t compare_pattern_scan(void* prog, const char* data, size_t len) {
+    size_t count = 0, pos = 0;
+    Pattern_State ps;
+    while(pos <= len && pattern_match_program_ex(&ps, prog, data, len, pos) == PATTERN_MATCH) {
+        count++;
+        size_t end = ps.captures[0].data - data + ps.captures[0].size;
+        pos = end > pos ? end : pos + 1;
+    }
+    return count;
+}
+
+#ifdef BENCH_HAVE_PCRE2
+typedef struct {
+    pcre2_code* code;
+    pcre2_match_data* match_data;
+} Compare_Pcre2;
+
+static void* compare_pcre2_compile_ex(const Compare_Case* c, bool jit) {
+    int err;
+    PCRE2_SIZE err_offset;
+    Compare_Pcre2* re = malloc(sizeof(*re));
+    if(!re) return NULL;
+    re->code = pcre2_compile((PCRE2_SPTR)c->regex, PCRE2_ZERO_TERMINATED, 0, &err, &err_offset,
+                             NULL);
+    if(!re->code || (jit && pcre2_jit_compile(re->code, PCRE2_JIT_COMPLETE) != 0)) {
+        if(re->code) pcre2_code_free(re->code);
+        free(re);
+        return NULL;
+    }
+    re->match_data = pcre2_match_data_create_from_pattern(re->code, NULL);
+    return re;
+}
+
+static void* compare_pcre2_compile(const Compare_Case* c) {
+    return compare_pcre2_compile_ex(c, false);
+}
+
+static void* compare_pcre2_jit_compile(const Compare_Case* c) {
+    return compare_pcre2_compile_ex(c, true);
+}
+
+// `pcre2_match` uses the JIT code when the pattern was JIT compiled
+static size_t compare_pcre2_scan(void* prog, const char* data, size_t len) {
+    Compare_Pcre2* re = prog;
+    size_t count = 0, pos = 0;
+    while(pos <= len && pcre2_match(re->code, (PCRE2_SPTR)data, len, pos, 0, re->match_data,
+                                    NULL) > 0) {
+        count++;
+        PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(re->match_data);
+        pos = ovector[1] > pos ? ovector[1] : pos + 1;
+    }
+    return count;
+}
+
+static void compare_pcre2_free(void* prog) {
+    Compare_Pcre2* re = prog;
+    pcre2_match_data_free(re->match_data);
+    pcre2_code_free(re->code);
+    free(re);
+}
+#endif
+
+#ifdef BENCH_HAVE_RE2
+// Implemented in re2.cc
+void* bench_re2_compile(const char* regex);
+size_t bench_re2_scan(void* prog, const char* data, size_t len);
+void bench_re2_free(void* prog);
+
+static void* compare_re2_compile(const Compare_Case* c) {
+    return bench_re2_compile(c->regex);
+}
+#endif
+
+static const Compare_Engine compare_engines[] = {
+    {"pattern.h", compare_pattern_compile, compare_pattern_scan, free},
+#ifdef BENCH_HAVE_PCRE2
+    {"pcre2", compare_pcre2_compile, compare_pcre2_scan, compare_pcre2_free},
+    {"pcre2-jit", compare_pcre2_jit_compile, compare_pcre2_scan, compare_pcre2_free},
+#endif
+#ifdef BENCH_HAVE_RE2
+    {"re2", compare_re2_compile, bench_re2_scan, bench_re2_free},
+#endif
+};
+
+#define COMPARE_ENGINES     (sizeof(compare_engines) / sizeof(*compare_engines))
+#define COMPARE_CATEGORIES  6
+#define COMPARE_MIN_SECONDS 0.2
+
+static const char* const compare_categories[COMPARE_CATEGORIES] = {
+    "literal", "class", "captures", "lazy", "binary", "adversarial",
+};
+
+static double compare_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Scans `data` repeatedly for at least `COMPARE_MIN_SECONDS`, returns MiB/s
+static double compare_throughput(const Compare_Engine* e, void* prog, const char* data, size_t len,
+                                 size_t* matches) {
+    size_t runs = 0;
+    double start = compare_now(), elapsed;
+    do {
+        *matches = e->scan(prog, data, len);
+        runs++;
+    } while((elapsed = compare_now() - start) < COMPARE_MIN_SECONDS);
+    return (double)(runs * len) / elapsed / (1 << 20);
+}
+
+static int compare_category(const char* category) {
+    for(int i = 0; i < COMPARE_CATEGORIES; i++) {
+        if(!strcmp(compare_categories[i], category)) return i;
+    }
+    return -1;
+}
+
+int main(int argc, char** argv) {
+    size_t size = 1u << 20;
+    uint64_t seed = 0;
+    const char* filter = NULL;
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--size") && i + 1 < argc) {
+            size = strtoul(argv[++i], NULL, 10);
+        } else if(!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if(argv[i][0] != '-' && !filter) {
+            filter = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [--size BYTES] [--seed N] [filter]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+#ifndef BENCH_HAVE_PCRE2
+    printf("pcre2: not found, skipped\n");
+#endif
+#ifndef BENCH_HAVE_RE2
+    printf("re2: not found, skipped\n");
+#endif
+
+    char* data = malloc(size);
+    if(!data || size == 0) return EXIT_FAILURE;
+
+    // Sums of the logarithms of the relative throughputs, for the geometric means
+    double log_sums[COMPARE_CATEGORIES][COMPARE_ENGINES] = {{0}};
+    int log_counts[COMPARE_CATEGORIES][COMPARE_ENGINES] = {{0}};
+
+    printf("%-12s %-13s %-10s %10s %10s %9s\n", "category", "case", "engine", "MiB/s",
+           "relative", "matches");
+    for(size_t c = 0; c < sizeof(compare_cases) / sizeof(*compare_cases); c++) {
+        const Compare_Case* cc = &compare_cases[c];
+        if(filter && !strstr(cc->name, filter) && strcmp(cc->category, filter)) continue;
+        corpus_generate(cc->corpus, seed, data, size);
+
+        int category = compare_category(cc->category);
+        double baseline = 0;
+        size_t baseline_matches = 0;
+        for(size_t e = 0; e < COMPARE_ENGINES; e++) {
+            const Compare_Engine* engine = &compare_engines[e];
+            void* prog = engine->compile(cc);
+            if(!prog) {
+                printf("%-12s %-13s %-10s %10s\n", cc->category, cc->name, engine->name,
+                       "failed to compile");
+                continue;
+            }
+            size_t matches;
+            double mibs = compare_throughput(engine, prog, data, size, &matches);
+            engine->free(prog);
+            if(e == 0) baseline = mibs, baseline_matches = matches;
+
+            printf("%-12s %-13s %-10s %10.1f %9.2fx %9zu%s\n", cc->category, cc->name,
+                   engine->name, mibs, mibs / baseline, matches,
+                   matches != baseline_matches ? " (differs from pattern.h)" : "");
+            log_sums[category][e] += log(mibs / baseline);
+            log_counts[category][e]++;
+        }
+    }
+    free(data);
+
+    printf("\nGeometric mean of the throughput relative to pattern.h\n%-12s", "category");
+    for(size_t e = 0; e < COMPARE_ENGINES; e++) printf(" %10s", compare_engines[e].name);
+    printf("\n");
+    for(int i = 0; i < COMPARE_CATEGORIES; i++) {
+        if(!log_counts[i][0]) continue;
+        printf("%-12s", compare_categories[i]);
+        for(size_t e = 0; e < COMPARE_ENGINES; e++) {
+            if(log_counts[i][e]) {
+                printf(" %9.2fx", exp(log_sums[i][e] / log_counts[i][e]));
+            } else {
+                printf(" %10s", "-");
+            }
+        }
+        printf("\n");
+    }
+    return EXIT_SUCCESS;
+}
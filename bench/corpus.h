@@ -0,0 +1,269 @@
+// Deterministic synthetic corpora for the benchmarks.
+//
+// `corpus_generate` fills a buffer with data resembling a real-world input, derived only from the
+// seed: the same seed and size produce the same bytes on any machine, as the generator doesn't
+// depend on `rand`, the locale or the clock.
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef enum {
+    CORPUS_ACCESS_LOG,   // Web server access logs, combined log format
+    CORPUS_SYSLOG,       // Syslog messages
+    CORPUS_CSV,          // CSV with a header, quoted fields and embedded commas
+    CORPUS_JSONL,        // JSON objects, one per line
+    CORPUS_CODE,         // C-like source code
+    CORPUS_BINARY,       // Random bytes with frequent embedded NULs
+    CORPUS_ADVERSARIAL,  // Long runs and near misses that stress backtracking
+    CORPUS_PATHS,        // File paths, one per line
+    CORPUS_KIND_COUNT,
+} Corpus_Kind;
+
+static const char* const corpus_kind_names[CORPUS_KIND_COUNT] = {
+    "access_log", "syslog", "csv", "jsonl", "code", "binary", "adversarial", "paths",
+};
+
+typedef struct {
+    uint64_t state;
+} Corpus_Rng;
+
+// splitmix64
+static uint64_t corpus_next(Corpus_Rng* rng) {
+    uint64_t z = (rng->state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static unsigned corpus_below(Corpus_Rng* rng, unsigned n) {
+    return (unsigned)(corpus_next(rng) % n);
+}
+
+#define corpus_pick(rng, array) ((array)[corpus_below(rng, sizeof(array) / sizeof(*(array)))])
+
+static const char* const corpus_words[] = {
+    "alpha", "bravo", "cache", "delta", "error", "fetch", "group", "index", "json",  "kernel",
+    "load",  "merge", "node",  "order", "parse", "query", "retry", "state", "token", "user",
+    "value", "write", "zone",  "lorem", "ipsum", "dolor", "timeout", "request", "session",
+};
+static const char* const corpus_methods[] = {"GET", "GET", "GET", "POST", "PUT", "DELETE", "HEAD"};
+static const char* const corpus_months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                            "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+static const char* const corpus_agents[] = {
+    "Mozilla/5.0 (X11; Linux x86_64; rv:126.0) Gecko/20100101 Firefox/126.0",
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 Chrome/125.0 Safari/537.36",
+    "curl/8.5.0",
+    "Go-http-client/1.1",
+};
+static const char* const corpus_procs[] = {"sshd", "kernel", "systemd", "cron", "nginx", "dockerd"};
+static const char* const corpus_dirs[] = {"var", "log", "home", "srv", "src", "cache",
+                                          "build", "lib", "tmp", "usr", "share", "data"};
+static const char* const corpus_extensions[] = {".c", ".h", ".o", ".log", ".json", ".tmp", ".txt"};
+static const char* const corpus_keywords[] = {"if", "for", "while", "return", "static", "const",
+                                              "int", "char", "size_t", "bool"};
+
+// The values of a line are drawn one statement at a time: the evaluation order of function
+// arguments is unspecified, so drawing them in a `snprintf` call would not be reproducible.
+
+static int corpus_path(Corpus_Rng* rng, char* out, size_t size) {
+    int n = 0;
+    unsigned depth = 1 + corpus_below(rng, 4);
+    for(unsigned i = 0; i < depth && (size_t)n < size; i++) {
+        n += snprintf(out + n, size - n, "/%s", corpus_pick(rng, corpus_words));
+    }
+    if((size_t)n < size && corpus_below(rng, 2)) {
+        const char* key = corpus_pick(rng, corpus_words);
+        n += snprintf(out + n, size - n, "?%s=%u", key, corpus_below(rng, 10000));
+    }
+    return n;
+}
+
+static int corpus_access_log(Corpus_Rng* rng, char* line, size_t size) {
+    static const unsigned statuses[] = {200, 200, 200, 200, 301, 304, 404, 500};
+    unsigned ip[4];
+    for(int i = 0; i < 4; i++) ip[i] = corpus_below(rng, 256);
+    const char* user = corpus_below(rng, 4) ? "-" : corpus_pick(rng, corpus_words);
+    unsigned day = 1 + corpus_below(rng, 28);
+    const char* month = corpus_pick(rng, corpus_months);
+    unsigned hour = corpus_below(rng, 24), min = corpus_below(rng, 60);
+    unsigned sec = corpus_below(rng, 60);
+    const char* method = corpus_pick(rng, corpus_methods);
+    char path[128];
+    corpus_path(rng, path, sizeof(path));
+    unsigned status = corpus_pick(rng, statuses), bytes = corpus_below(rng, 100000);
+    const char* agent = corpus_pick(rng, corpus_agents);
+    return snprintf(line, size,
+                    "%u.%u.%u.%u - %s [%02u/%s/2024:%02u:%02u:%02u +0000] \"%s %s HTTP/1.1\" %u "
+                    "%u \"-\" \"%s\"\n",
+                    ip[0], ip[1], ip[2], ip[3], user, day, month, hour, min, sec, method, path,
+                    status, bytes, agent);
+}
+
+static int corpus_syslog(Corpus_Rng* rng, char* line, size_t size) {
+    const char* month = corpus_pick(rng, corpus_months);
+    unsigned day = 1 + corpus_below(rng, 28);
+    unsigned hour = corpus_below(rng, 24), min = corpus_below(rng, 60);
+    unsigned sec = corpus_below(rng, 60), host = corpus_below(rng, 16);
+    const char* proc = corpus_pick(rng, corpus_procs);
+    unsigned pid = 1 + corpus_below(rng, 65535);
+    const char* verb = corpus_pick(rng, corpus_words);
+    const char* object = corpus_pick(rng, corpus_words);
+    const char* key = corpus_pick(rng, corpus_words);
+    unsigned value = corpus_below(rng, 1000);
+    return snprintf(line, size, "%s %2u %02u:%02u:%02u host%02u %s[%u]: %s %s %s=%u\n", month, day,
+                    hour, min, sec, host, proc, pid, verb, object, key, value);
+}
+
+static int corpus_csv(Corpus_Rng* rng, char* line, size_t size, size_t row) {
+    if(row == 0) return snprintf(line, size, "id,name,email,amount,date,note\n");
+    const char* name = corpus_pick(rng, corpus_words);
+    unsigned mailbox = corpus_below(rng, 100);
+    unsigned units = corpus_below(rng, 10000), cents = corpus_below(rng, 100);
+    unsigned month = 1 + corpus_below(rng, 12), day = 1 + corpus_below(rng, 28);
+    const char* note = corpus_pick(rng, corpus_words);
+    // Quoted notes may contain commas
+    bool quoted = corpus_below(rng, 3) == 0;
+    bool comma = quoted && corpus_below(rng, 2);
+    return snprintf(line, size, "%zu,%s,%s.%u@example.com,%u.%02u,2024-%02u-%02u,%s%s%s%s\n", row,
+                    name, name, mailbox, units, cents, month, day, quoted ? "\"" : "", note,
+                    comma ? ", with comma" : "", quoted ? "\"" : "");
+}
+
+static int corpus_jsonl(Corpus_Rng* rng, char* line, size_t size, size_t row) {
+    const char* user = corpus_pick(rng, corpus_words);
+    bool active = corpus_below(rng, 2);
+    unsigned score = corpus_below(rng, 100), decimal = corpus_below(rng, 10);
+    const char* tag1 = corpus_pick(rng, corpus_words);
+    const char* tag2 = corpus_pick(rng, corpus_words);
+    unsigned retries = corpus_below(rng, 5);
+    const char* note = corpus_pick(rng, corpus_words);
+    const char* quote = corpus_pick(rng, corpus_words);
+    return snprintf(line, size,
+                    "{\"id\":%zu,\"user\":\"%s\",\"active\":%s,\"score\":%u.%u,"
+                    "\"tags\":[\"%s\",\"%s\"],"
+                    "\"meta\":{\"retries\":%u,\"note\":\"%s \\\"%s\\\"\"}}\n",
+                    row, user, active ? "true" : "false", score, decimal, tag1, tag2, retries, note,
+                    quote);
+}
+
+static int corpus_code(Corpus_Rng* rng, char* line, size_t size) {
+    int indent = 4 * corpus_below(rng, 4);
+    const char* a = corpus_pick(rng, corpus_words);
+    const char* b = corpus_pick(rng, corpus_words);
+    switch(corpus_below(rng, 5)) {
+    case 0: {
+        const char* keyword = corpus_pick(rng, corpus_keywords);
+        unsigned n = corpus_below(rng, 256);
+        return snprintf(line, size, "%*s%s %s_%s = %s(%s, %u);\n", indent, "", keyword, a, b, b,
+                        a, n);
+    }
+    case 1: {
+        unsigned idx = corpus_below(rng, 16);
+        char c = (char)('a' + corpus_below(rng, 26));
+        return snprintf(line, size, "%*sif(%s->%s != NULL && %s[%u] == '%c') {\n", indent, "", a,
+                        b, a, idx, c);
+    }
+    case 2: {
+        const char* c = corpus_pick(rng, corpus_words);
+        return snprintf(line, size, "%*s// %s the %s before %s\n", indent, "", a, b, c);
+    }
+    case 3:
+        return snprintf(line, size, "%*sprintf(\"%s: %%d (%s)\\n\", %s);\n", indent, "", a, b, a);
+    default:
+        return snprintf(line, size, "%*s}\n", indent, "");
+    }
+}
+
+// Deep trees mixing directory names and words, with rotated logs (`.log.3`)
+static int corpus_file_path(Corpus_Rng* rng, char* line, size_t size) {
+    int n = 0;
+    unsigned depth = 2 + corpus_below(rng, 10);
+    for(unsigned i = 0; i < depth && (size_t)n < size; i++) {
+        const char* dir = i % 2 ? corpus_pick(rng, corpus_words) : corpus_pick(rng, corpus_dirs);
+        n += snprintf(line + n, size - n, "/%s", dir);
+    }
+    const char* name = corpus_pick(rng, corpus_words);
+    const char* extension = corpus_pick(rng, corpus_extensions);
+    if((size_t)n < size) n += snprintf(line + n, size - n, "/%s%s", name, extension);
+    if((size_t)n < size && !strcmp(extension, ".log") && corpus_below(rng, 2)) {
+        unsigned rotation = corpus_below(rng, 10);
+        n += snprintf(line + n, size - n, ".%u", rotation);
+    }
+    if((size_t)n < size) line[n++] = '\n';
+    return n;
+}
+
+static int corpus_adversarial(Corpus_Rng* rng, char* line, size_t size) {
+    static const char runs[] = "a (\t%0";
+    char c = runs[corpus_below(rng, sizeof(runs) - 1)];
+    int n = 64 + corpus_below(rng, 1024);
+    if((size_t)n >= size) n = (int)size - 1;
+    memset(line, c, n);
+    // Near misses: the run ends with something close to what a pattern would look for
+    switch(corpus_below(rng, 4)) {
+    case 0:
+        n += snprintf(line + n, size - n, "%c", c == 'a' ? 'b' : ')');
+        break;
+    case 1:
+        n += snprintf(line + n, size - n, "%s", "((((((((");
+        break;
+    case 2:
+        n += snprintf(line + n, size - n, "%s", "2024-10-1");
+        break;
+    }
+    if((size_t)n < size) line[n++] = '\n';
+    return n;
+}
+
+// Fills `out` with exactly `size` bytes of data of the given kind. Line-based kinds are cut at
+// `size`, so the last line may be incomplete.
+static void corpus_generate(Corpus_Kind kind, uint64_t seed, char* out, size_t size) {
+    Corpus_Rng rng = {seed * 0x9e3779b97f4a7c15ull + kind};
+    char line[2048];
+    size_t pos = 0;
+    for(size_t row = 0; pos < size; row++) {
+        int n = 0;
+        switch(kind) {
+        case CORPUS_ACCESS_LOG:
+            n = corpus_access_log(&rng, line, sizeof(line));
+            break;
+        case CORPUS_SYSLOG:
+            n = corpus_syslog(&rng, line, sizeof(line));
+            break;
+        case CORPUS_CSV:
+            n = corpus_csv(&rng, line, sizeof(line), row);
+            break;
+        case CORPUS_JSONL:
+            n = corpus_jsonl(&rng, line, sizeof(line), row);
+            break;
+        case CORPUS_CODE:
+            n = corpus_code(&rng, line, sizeof(line));
+            break;
+        case CORPUS_BINARY:
+            for(; n < 256; n++) {
+                uint64_t r = corpus_next(&rng);
+                line[n] = r % 4 == 0 ? '\0' : (char)(r >> 8);
+            }
+            break;
+        case CORPUS_ADVERSARIAL:
+            n = corpus_adversarial(&rng, line, sizeof(line));
+            break;
+        case CORPUS_PATHS:
+            n = corpus_file_path(&rng, line, sizeof(line));
+            break;
+        case CORPUS_KIND_COUNT:
+            return;
+        }
+        if((size_t)n >= sizeof(line)) n = sizeof(line) - 1;
+        if((size_t)n > size - pos) n = (int)(size - pos);
+        memcpy(out + pos, line, n);
+        pos += n;
+    }
+}
+
+#endif
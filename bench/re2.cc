@@ -0,0 +1,39 @@
+// C interface to RE2 for bench/compare.c
+#include <re2/re2.h>
+
+#include <cstddef>
+#include <vector>
+
+extern "C" {
+
+void* bench_re2_compile(const char* regex) {
+    RE2::Options options;
+    options.set_encoding(RE2::Options::EncodingLatin1);
+    options.set_log_errors(false);
+    RE2* re = new RE2(regex, options);
+    if(!re->ok()) {
+        delete re;
+        return NULL;
+    }
+    return re;
+}
+
+// Finds all the matches, extracting the captures as pattern.h does
+size_t bench_re2_scan(void* prog, const char* data, size_t len) {
+    const RE2* re = static_cast<const RE2*>(prog);
+    std::vector<re2::StringPiece> groups(re->NumberOfCapturingGroups() + 1);
+    re2::StringPiece text(data, len);
+    size_t count = 0, pos = 0;
+    while(pos <= len &&
+          re->Match(text, pos, len, RE2::UNANCHORED, groups.data(), (int)groups.size())) {
+        count++;
+        size_t end = groups[0].data() - data + groups[0].size();
+        pos = end > pos ? end : pos + 1;
+    }
+    return count;
+}
+
+void bench_re2_free(void* prog) {
+    delete static_cast<RE2*>(prog);
+}
+}
@@ -0,0 +1,310 @@
+// Lua 5.4 module exposing compiled patterns
+//
+//     local pattern = require "pattern"
+//     local p = pattern.compile("(%w+)=(%w+)")
+//     for k, v in p:gmatch(s) do ... end
+//
+// Programs are compiled once, then `:match`, `:find`, `:gmatch` and `:gsub` behave like their
+// `string` counterparts while using the compiled fast paths of pattern.h.
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <ctype.h>
+#include <string.h>
+
+#define PATTERN_IMPLEMENTATION
+#include "../pattern.h"
+
+#define LPATTERN_PROGRAM "pattern.Program"
+
+// Programs keep the pattern string alive in their user value
+static Pattern_Program* lpattern_check(lua_State* L, int arg) {
+    return (Pattern_Program*)luaL_checkudata(L, arg, LPATTERN_PROGRAM);
+}
+
+static int lpattern_error(lua_State* L, const Pattern_State* ps) {
+    return luaL_error(L, "malformed pattern (%s) at position %d", pattern_strerror(ps->error),
+                      (int)ps->error_loc + 1);
+}
+
+// Converts a relative initial position like `string.find` does, returns a 0-based offset
+static size_t lpattern_init_pos(lua_State* L, int arg, size_t len) {
+    lua_Integer pos = luaL_optinteger(L, arg, 1);
+    if(pos > 0) return (size_t)pos - 1;
+    if(pos == 0 || (size_t)-pos > len) return 0;
+    return len - (size_t)-pos;
+}
+
+static void lpattern_push_capture(lua_State* L, const Pattern_State* ps, int idx) {
+    if(pattern_is_position_capture(ps, idx)) {
+        lua_pushinteger(L, (lua_Integer)pattern_get_capture_pos(ps, idx) + 1);
+    } else {
+        lua_pushlstring(L, ps->captures[idx].data, ps->captures[idx].size);
+    }
+}
+
+// Pushes the captures, or the whole match if there are none (when `whole_if_none`)
+static int lpattern_push_captures(lua_State* L, const Pattern_State* ps, bool whole_if_none) {
+    int count = ps->capture_count - 1;
+    if(count == 0 && whole_if_none) {
+        lpattern_push_capture(L, ps, 0);
+        return 1;
+    }
+    luaL_checkstack(L, count, "too many captures");
+    for(int i = 1; i <= count; i++) lpattern_push_capture(L, ps, i);
+    return count;
+}
+
+// Searches from offset `pos`, raising errors. Returns true on a match.
+static bool lpattern_search(lua_State* L, Pattern_State* ps, const Pattern_Program* prog,
+                            const char* s, size_t len, size_t pos) {
+    Pattern_Status status = pattern_match_program_ex(ps, prog, s, len, pos);
+    if(status == PATTERN_ERROR) lpattern_error(L, ps);
+    return status == PATTERN_MATCH;
+}
+
+// Replaces the pattern string at the top of the stack with a program compiled from it
+static void lpattern_push_program(lua_State* L, int flags) {
+    const char* pattern = lua_tostring(L, -1);
+    Pattern_Program* prog = (Pattern_Program*)lua_newuserdatauv(L, sizeof(*prog), 1);
+    lua_insert(L, -2);
+    lua_setiuservalue(L, -2, 1);
+    pattern_compile_ex(prog, pattern, flags);
+    luaL_setmetatable(L, LPATTERN_PROGRAM);
+}
+
+static int lpattern_compile(lua_State* L) {
+    size_t len;
+    const char* pattern = luaL_checklstring(L, 1, &len);
+    int flags = (int)luaL_optinteger(L, 2, 0);
+    luaL_argcheck(L, strlen(pattern) == len, 1, "pattern contains embedded zeros (use %z)");
+
+    lua_settop(L, 1);
+    lpattern_push_program(L, flags);
+    return 1;
+}
+
+static int lpattern_find_aux(lua_State* L, bool find) {
+    const Pattern_Program* prog = lpattern_check(L, 1);
+    size_t len;
+    const char* s = luaL_checklstring(L, 2, &len);
+    size_t pos = lpattern_init_pos(L, 3, len);
+    if(pos > len) {
+        luaL_pushfail(L);
+        return 1;
+    }
+
+    Pattern_State ps;
+    if(!lpattern_search(L, &ps, prog, s, len, pos)) {
+        luaL_pushfail(L);
+        return 1;
+    }
+    if(!find) return lpattern_push_captures(L, &ps, true);
+
+    size_t start = pattern_get_capture_pos(&ps, 0);
+    lua_pushinteger(L, (lua_Integer)start + 1);
+    lua_pushinteger(L, (lua_Integer)(start + ps.captures[0].size));
+    return 2 + lpattern_push_captures(L, &ps, false);
+}
+
+static int lpattern_match(lua_State* L) {
+    return lpattern_find_aux(L, false);
+}
+
+static int lpattern_find(lua_State* L) {
+    return lpattern_find_aux(L, true);
+}
+
+typedef struct {
+    size_t pos;         // Offset where the next search starts
+    size_t last_match;  // End of the previous match, an empty match isn't allowed there
+    bool matched;
+} Lpattern_Gmatch;
+
+// Upvalues: the program, the subject string and the iteration state
+static int lpattern_gmatch_aux(lua_State* L) {
+    const Pattern_Program* prog = (const Pattern_Program*)lua_touserdata(L, lua_upvalueindex(1));
+    size_t len;
+    const char* s = lua_tolstring(L, lua_upvalueindex(2), &len);
+    Lpattern_Gmatch* gm = (Lpattern_Gmatch*)lua_touserdata(L, lua_upvalueindex(3));
+
+    // Globs match the whole string, at the initial position only
+    if(prog->anchored && gm->matched) return 0;
+
+    Pattern_State ps;
+    while(gm->pos <= len && lpattern_search(L, &ps, prog, s, len, gm->pos)) {
+        size_t start = pattern_get_capture_pos(&ps, 0);
+        size_t end = start + ps.captures[0].size;
+        if(gm->matched && end == gm->last_match) {
+            // An empty match right after the previous one, retry one character later (as Lua does)
+            gm->pos = start + 1;
+            continue;
+        }
+        gm->pos = gm->last_match = end;
+        gm->matched = true;
+        return lpattern_push_captures(L, &ps, true);
+    }
+    gm->pos = len + 1;
+    return 0;
+}
+
+static int lpattern_gmatch(lua_State* L) {
+    const Pattern_Program* prog = lpattern_check(L, 1);
+    size_t len;
+    luaL_checklstring(L, 2, &len);
+    size_t pos = lpattern_init_pos(L, 3, len);
+    lua_settop(L, 2);
+
+    // `string.gmatch` takes a leading `^` literally, iterate over a program that does the same
+    if(prog->anchored && !(prog->flags & PATTERN_GLOB)) {
+        lua_pushfstring(L, "%%^%s", prog->pattern + 1);
+        lpattern_push_program(L, prog->flags);
+        lua_replace(L, 1);
+    }
+
+    Lpattern_Gmatch* gm = (Lpattern_Gmatch*)lua_newuserdatauv(L, sizeof(*gm), 0);
+    gm->pos = pos;
+    gm->last_match = 0;
+    gm->matched = false;
+    lua_pushcclosure(L, lpattern_gmatch_aux, 3);
+    return 1;
+}
+
+// Expands a replacement string like `string.gsub`: `%0`-`%9` are captures, `%%` is a `%`
+static void lpattern_add_string(lua_State* L, luaL_Buffer* b, const Pattern_State* ps,
+                                const char* repl, size_t repl_len) {
+    const char* end = repl + repl_len;
+    const char* escape;
+    while((escape = (const char*)memchr(repl, PATTERN_ESCAPE, end - repl)) != NULL) {
+        luaL_addlstring(b, repl, escape - repl);
+        escape++;
+        if(escape < end && *escape == PATTERN_ESCAPE) {
+            luaL_addchar(b, PATTERN_ESCAPE);
+        } else if(escape < end && isdigit((unsigned char)*escape)) {
+            int capture = *escape - '0';
+            if(capture == 1 && ps->capture_count == 1) capture = 0;
+            if(capture >= ps->capture_count) luaL_error(L, "invalid capture index %%%d", capture);
+            lpattern_push_capture(L, ps, capture);
+            luaL_tolstring(L, -1, NULL);
+            lua_remove(L, -2);
+            luaL_addvalue(b);
+        } else {
+            luaL_error(L, "invalid use of '%c' in replacement string", PATTERN_ESCAPE);
+        }
+        repl = escape + 1;
+    }
+    luaL_addlstring(b, repl, end - repl);
+}
+
+// Adds the replacement of the current match, the replacement being the argument 3
+static void lpattern_add_value(lua_State* L, luaL_Buffer* b, const Pattern_State* ps) {
+    switch(lua_type(L, 3)) {
+    case LUA_TFUNCTION: {
+        lua_pushvalue(L, 3);
+        int count = lpattern_push_captures(L, ps, true);
+        lua_call(L, count, 1);
+        break;
+    }
+    case LUA_TTABLE:
+        // Indexed by the first capture
+        lpattern_push_capture(L, ps, ps->capture_count > 1 ? 1 : 0);
+        lua_gettable(L, 3);
+        break;
+    default: {
+        size_t repl_len;
+        const char* repl = lua_tolstring(L, 3, &repl_len);
+        lpattern_add_string(L, b, ps, repl, repl_len);
+        return;
+    }
+    }
+
+    if(!lua_toboolean(L, -1)) {
+        // `nil` or `false` keep the original text
+        lua_pop(L, 1);
+        luaL_addlstring(b, ps->captures[0].data, ps->captures[0].size);
+    } else if(!lua_isstring(L, -1)) {
+        luaL_error(L, "invalid replacement value (a %s)", luaL_typename(L, -1));
+    } else {
+        luaL_addvalue(b);
+    }
+}
+
+// Same loop as `pattern_gsub_range`, with Lua's replacement values and maximum count
+static int lpattern_gsub(lua_State* L) {
+    const Pattern_Program* prog = lpattern_check(L, 1);
+    size_t len;
+    const char* s = luaL_checklstring(L, 2, &len);
+    int repl_type = lua_type(L, 3);
+    luaL_argexpected(L,
+                     repl_type == LUA_TNUMBER || repl_type == LUA_TSTRING ||
+                         repl_type == LUA_TFUNCTION || repl_type == LUA_TTABLE,
+                     3, "string/function/table");
+    lua_Integer max_count = luaL_optinteger(L, 4, (lua_Integer)len + 1);
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    Pattern_State ps;
+    size_t pos = 0;
+    bool after_match = false;
+    lua_Integer count = 0;
+    while(count < max_count) {
+        if(prog->anchored && pos != 0) break;
+        if(!lpattern_search(L, &ps, prog, s, len, pos)) break;
+
+        size_t start = pattern_get_capture_pos(&ps, 0);
+        size_t end = start + ps.captures[0].size;
+        if(end == pos && after_match) {
+            if(pos == len) break;
+            luaL_addchar(&b, s[pos++]);
+            after_match = false;
+            continue;
+        }
+
+        luaL_addlstring(&b, s + pos, start - pos);
+        lpattern_add_value(L, &b, &ps);
+        count++;
+        pos = end;
+        after_match = true;
+        if(prog->anchored) break;
+    }
+
+    luaL_addlstring(&b, s + pos, len - pos);
+    luaL_pushresult(&b);
+    lua_pushinteger(L, count);
+    return 2;
+}
+
+static int lpattern_tostring(lua_State* L) {
+    const Pattern_Program* prog = lpattern_check(L, 1);
+    lua_pushfstring(L, "pattern: %s", prog->pattern);
+    return 1;
+}
+
+static const luaL_Reg lpattern_methods[] = {
+    {"match", lpattern_match},
+    {"find", lpattern_find},
+    {"gmatch", lpattern_gmatch},
+    {"gsub", lpattern_gsub},
+    {NULL, NULL},
+};
+
+static const luaL_Reg lpattern_functions[] = {
+    {"compile", lpattern_compile},
+    {NULL, NULL},
+};
+
+int luaopen_pattern(lua_State* L) {
+    luaL_newmetatable(L, LPATTERN_PROGRAM);
+    luaL_newlib(L, lpattern_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, lpattern_tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_pop(L, 1);
+
+    luaL_newlib(L, lpattern_functions);
+    lua_pushinteger(L, PATTERN_EXTENDED);
+    lua_setfield(L, -2, "EXTENDED");
+    lua_pushinteger(L, PATTERN_GLOB);
+    lua_setfield(L, -2, "GLOB");
+    return 1;
+}
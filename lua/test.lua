@@ -0,0 +1,93 @@
+-- Checks the module against Lua's own string functions, run with `make lua-test`
+local pattern = require "pattern"
+
+local function pack(...)
+    return {n = select("#", ...), ...}
+end
+
+local function same(a, b)
+    if a.n ~= b.n then return false end
+    for i = 1, a.n do
+        if a[i] ~= b[i] then return false end
+    end
+    return true
+end
+
+local function check(name, p, got, expected)
+    if not same(got, expected) then
+        error(string.format("%s(%q): got %d results, expected %d", name, p, got.n, expected.n), 2)
+    end
+end
+
+local subjects = {
+    "",
+    "hello world",
+    "key=value, other=42",
+    "  padded text  ",
+    "GET /index.html HTTP/1.1",
+    "a,b,,c",
+    "(nested (parens)) here",
+    "THE (quick) fox",
+    "x = 1.5, y = -2",
+    "a^b ^GET c^d",
+}
+
+local patterns = {
+    "%w+", "(%w+)=(%w+)", "^%s*(.-)%s*$", "%-?%d+%.?%d*", "()", "()a", "(%a)%1", "%b()",
+    "%f[%a]%a+", "[^,]*", "^GET", "%s*$", "x*", ".-", "(h)(e)", "%u+", "o", "", "(%S+)",
+}
+
+for _, p in ipairs(patterns) do
+    local prog = pattern.compile(p)
+    for _, s in ipairs(subjects) do
+        for _, init in ipairs({1, 3, -4, #s + 1, #s + 2}) do
+            check("match", p, pack(prog:match(s, init)), pack(string.match(s, p, init)))
+            check("find", p, pack(prog:find(s, init)), pack(string.find(s, p, init)))
+        end
+
+        local got, expected = {}, {}
+        for a, b in prog:gmatch(s) do
+            got[#got + 1] = tostring(a) .. "|" .. tostring(b)
+        end
+        for a, b in s:gmatch(p) do
+            expected[#expected + 1] = tostring(a) .. "|" .. tostring(b)
+        end
+        check("gmatch", p, pack(table.concat(got, ";")), pack(table.concat(expected, ";")))
+
+        for _, repl in ipairs({"<%0>", "%1%1", "", "%%"}) do
+            check("gsub", p, pack(pcall(prog.gsub, prog, s, repl)),
+                  pack(pcall(string.gsub, s, p, repl)))
+        end
+        check("gsub", p, pack(prog:gsub(s, string.upper, 2)),
+              pack(string.gsub(s, p, string.upper, 2)))
+        local t = {hello = "HI", key = false, a = 1}
+        check("gsub", p, pack(prog:gsub(s, t)), pack(string.gsub(s, p, t)))
+    end
+end
+
+-- Errors are reported when matching, like `string.match`
+local ok, err = pcall(function() return pattern.compile("(%w+"):match("abc") end)
+assert(not ok and err:find("malformed pattern (capture not closed) at position 1", 1, true))
+
+-- A leading `^` is a literal in `:gmatch`, like in `string.gmatch`
+local carets = {}
+for c in pattern.compile("^(%a)"):gmatch("a^b c^d", 2) do carets[#carets + 1] = c end
+assert(table.concat(carets) == "bd")
+
+-- Extended syntax
+local method = pattern.compile("^(GET|POST|PUT) (%S+)", pattern.EXTENDED)
+assert(method:match("POST /api HTTP/1.1") == "POST")
+assert(select(2, method:match("PUT /x")) == "/x")
+assert(method:match("PATCH /x") == nil)
+assert(pattern.compile("%d{2,3}", pattern.EXTENDED):match("1 12345") == "123")
+assert(tostring(method) == "pattern: ^(GET|POST|PUT) (%S+)")
+
+-- Globs
+local logs = pattern.compile("*.log.[0-9]*", pattern.GLOB)
+assert(logs:match("/var/log/app.log.3") == "/var/log/app.log.3")
+assert(logs:match("/var/log/app.log") == nil)
+local count = 0
+for _ in logs:gmatch("app.log.1") do count = count + 1 end
+assert(count == 1)
+
+print("ok")
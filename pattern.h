@@ -1,5 +1,5 @@
 /**
- * pattern.h v1.1.0 - Lua's pattern matching in C
+ * pattern.h v1.2.0 - Lua's pattern matching in C
  *
  * Single header library implementing Lua's pattern matching
  *
@@ -12,11 +12,12 @@
  *     - Anchors (`^`, `$`)
  *     - Balanced matches (`%b`)
  *     - Frontier patterns (`%f`)
+ *     - Shell globs compiled to the same programs
  *     - Detailed error diagnostics with source location
  *
  * Limitations:
  *     - Not a full regex engine
- *     - No alternation (`|`)
+ *     - No alternation (`|`), except between literals with the extended syntax
  *     - No lookahead/lookbehind
  *
  * Pattern Syntax:
@@ -72,6 +73,29 @@
  *           Example: %f[%w] matches word boundaries
  *
  *  Changelog:
+ *  1.2.0:
+ *    Added compiled pattern programs (`pattern_compile`)
+ *    Added literal-suffix precheck for patterns ending with `$`
+ *    Repetitions followed by a back-reference locate candidates with a rolling hash
+ *    Added line-mode matching (`pattern_match_lines`) and helpers to split data at line boundaries
+ *    Added substitutions (`pattern_gsub`), resumable by range to process large data in chunks
+ *    Fixed-length compiled patterns are verified with per-position byte sets
+ *    Common idioms (trim, word runs, numbers, key/value pairs) are matched by linear routines
+ *    Added canonical forms and fingerprints of patterns (`pattern_canonicalize`)
+ *    Added extended syntax (`pattern_compile_ex`), with counted repetitions `{n}`, `{n,}`, `{n,m}`
+ *    Added extended literal alternation `(GET|POST|PUT)`, testing all alternatives in one pass
+ *    Added a Lua 5.4 module exposing compiled patterns (`lua/`)
+ *    Added pattern sets (`pattern_set_match`), learning the order in which their patterns win
+ *    Added `pattern_set_remove` and `pattern_set_compact`, to update sets without rebuilding them
+ *    Added handles (`pattern_handle_publish`) to swap programs and sets under concurrent matching
+ *    Added `pattern_set_compile_range` to compile large sets from many threads
+ *    Added locale snapshots (`pattern_locale_snapshot`), matching classes with table lookups
+ *    Bytes are classified as `unsigned char` by the ctype functions, like Lua does
+ *    Literal prefixes, runs, `%b` and newlines are scanned a word at a time (SWAR) in portable C
+ *    Searches skip starts by their first byte, and past the run of a leading repeated item
+ *    Added shell globs (`PATTERN_GLOB`), matched without backtracking
+ *    Added `pattern_match_range`, matching within a range with the data around it visible to `%f`
+ *    Fixed capture 0 of anchored matches not starting at the beginning of the data
  *  1.1.0:
  *    Added support for balanced matches and frontier patterns
  */
@@ -80,11 +104,33 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #ifndef PATTERN_MAX_CAPTURES
 #define PATTERN_MAX_CAPTURES 31
 #endif
+#ifndef PATTERN_MAX_SUFFIX
+#define PATTERN_MAX_SUFFIX 16
+#endif
+#ifndef PATTERN_MAX_PREFIX
+#define PATTERN_MAX_PREFIX 16
+#endif
+#ifndef PATTERN_MAX_FIXED_LEN
+#define PATTERN_MAX_FIXED_LEN 64
+#endif
+#ifndef PATTERN_MAX_FIXED_SETS
+#define PATTERN_MAX_FIXED_SETS 8
+#endif
+#ifndef PATTERN_SET_REORDER_INTERVAL
+#define PATTERN_SET_REORDER_INTERVAL 1024
+#endif
+#ifdef __GNUC__
+#define PATTERN_HAS_HANDLE  // `Pattern_Handle` needs the `__atomic` builtins of GCC and Clang
+#endif
+#define PATTERN_UNBOUNDED          ((size_t)-1)
+#define PATTERN_SET_NONE           ((size_t)-1)
+#define PATTERN_MAX_ALTERNATIVES   32  // Per extended alternation, one bit each in a `uint32_t`
 #define PATTERN_ESCAPE             '%'
 #define PATTERN_CAPTURE_UNFINISHED -1
 #define PATTERN_CAPTURE_POSITION   -2
@@ -104,6 +150,9 @@ typedef enum {
     PATTERN_ERR_UNCLOSED_CLASS,
     PATTERN_ERR_INVALID_BALANCED_PATTERN,
     PATTERN_ERR_UNCLOSED_FRONTIER_PATTERN,
+    PATTERN_ERR_INVALID_REPLACEMENT,
+    PATTERN_ERR_INVALID_REPETITION,
+    PATTERN_ERR_INVALID_ALTERNATION,
 } Pattern_Error;
 
 typedef enum {
@@ -112,15 +161,139 @@ typedef enum {
     PATTERN_ERROR,
 } Pattern_Status;
 
+// Flags of `pattern_compile_ex`
+typedef enum {
+    // Extended syntax, not compatible with Lua: `{n}`, `{n,}` and `{n,m}` after a single
+    // character, class or set repeat it greedily at least `n` and at most `m` times, and a group
+    // of literals separated by `|` matches the first alternative the rest of the pattern accepts
+    PATTERN_EXTENDED = 1 << 0,
+    // The pattern is a shell glob matched against the whole input: `*` matches any bytes, `?`
+    // any byte, `[...]` a byte of the set (`[!...]` or `[^...]` a byte out of it, with ranges
+    // like `a-z` and `]` as a member if first) and `\` escapes the next character. A `[` without
+    // a closing `]` is a literal, like for `fnmatch`. Other flags are ignored.
+    PATTERN_GLOB = 1 << 1,
+} Pattern_Flags;
+
+// Character classes of a locale, recorded by `pattern_locale_snapshot`
+typedef struct {
+    uint32_t classes[256];  // Bit `cls - 'a'` is set if the byte belongs to the class `%cls`
+} Pattern_Locale;
+
 typedef struct {
     Pattern_Error error;
     size_t error_loc;
     Pattern_Substring data;
+    size_t lookahead;  // Bytes past the end of `data` seen by `%f`, see `pattern_match_range`
     const char* pattern_base;
+    int flags;  // `Pattern_Flags` of the pattern being matched
+    const Pattern_Locale* locale;  // Classes of the pattern matched, NULL for the current locale
     int capture_count;
     Pattern_Substring captures[PATTERN_MAX_CAPTURES];
 } Pattern_State;
 
+// Common patterns recognised by the compiler and matched by dedicated linear routines
+typedef enum {
+    PATTERN_IDIOM_NONE = 0,
+    PATTERN_IDIOM_TRIM,       // `^%s*(.-)%s*$`
+    PATTERN_IDIOM_CLASS_RUN,  // A single character or class repeated with `+`, e.g. `(%S+)`
+    PATTERN_IDIOM_NUMBER,     // `%-?%d+%.?%d*`
+    PATTERN_IDIOM_KEY_VALUE,  // `(%w+)=(%w+)`
+} Pattern_Idiom;
+
+// Set of bytes, one bit per byte value
+typedef struct {
+    unsigned char bits[32];
+} Pattern_Byte_Set;
+
+// A pattern analysed ahead of matching, so that repeated matches don't have to re-examine it.
+// Compiling never fails: errors in malformed patterns are still reported by the matcher, such
+// patterns simply don't benefit from any of the precomputed information.
+typedef struct {
+    const char* pattern;
+    int flags;             // `Pattern_Flags` the pattern was compiled with
+    const Pattern_Locale* locale;  // Classes it was compiled with, NULL for the current locale
+    uint64_t fingerprint;  // Equal for patterns with the same canonical form and flags
+    bool well_formed;   // No error can be raised while matching, enables the fast paths below
+    bool anchored;      // Pattern starts with `^`
+    bool end_anchored;  // Pattern ends with `$`
+    size_t min_len;     // Minimum length of a match
+    size_t max_len;     // Maximum length of a match, or `PATTERN_UNBOUNDED`
+    size_t suffix_len;  // Bytes that must sit right before the end of the data when `end_anchored`
+    char suffix[PATTERN_MAX_SUFFIX];
+    size_t prefix_len;  // Bytes every match starts with
+    char prefix[PATTERN_MAX_PREFIX];
+    // First item of every match (past opening captures) and the repetition operator following it
+    // ('\0' if none, '{' for counted repetitions), `lead_item` being NULL if there is no such item
+    const char* lead_item;
+    const char* lead_item_end;
+    char lead_op;
+    bool has_backrefs;
+    bool has_first_bytes;
+    Pattern_Byte_Set first_bytes;  // Bytes every match starts with, when `has_first_bytes`
+    Pattern_Idiom idiom;
+    const char* idiom_item;  // The repeated item of `PATTERN_IDIOM_CLASS_RUN`
+    // Patterns made only of single characters or classes (no repetitions) match a fixed number of
+    // bytes. For these, `fixed_len` is the length of the match and `fixed_sets[fixed_class[i]]` is
+    // the set of bytes accepted at position `i`. `fixed_len` is 0 for every other pattern.
+    size_t fixed_len;
+    int fixed_set_count;
+    unsigned char fixed_class[PATTERN_MAX_FIXED_LEN];
+    Pattern_Byte_Set fixed_sets[PATTERN_MAX_FIXED_SETS];
+} Pattern_Program;
+
+// A pattern of a `Pattern_Set`, with the statistics used to order the verification
+typedef struct {
+    Pattern_Program prog;
+    uint64_t attempts;  // Times the pattern was verified
+    uint64_t hits;      // Times it was the winner
+    uint64_t cost;      // Bytes it handed to the matcher, its prefilters rejecting inputs for free
+    size_t rank;        // Position in the learned order
+    bool removed;       // Left by `pattern_set_remove` until the set is compacted
+} Pattern_Set_Entry;
+
+// Patterns matched as a whole, the first one that matches being the winner. The storage is provided
+// by the caller. Statistics collected while matching give the order in which the patterns usually
+// win the fastest (frequent winners that are cheap to verify first).
+typedef struct {
+    Pattern_Set_Entry* entries;  // In declaration order
+    size_t* order;               // Learned order, as indices in `entries`
+    size_t count;                // Including removed patterns
+    size_t capacity;
+    size_t removed;              // Removed patterns still taking room in `entries`
+    size_t reorder_interval;  // Matches between reorderings, 0 disables the statistics
+    size_t matches;           // Matches since the last reordering
+} Pattern_Set;
+
+#ifdef PATTERN_HAS_HANDLE
+// A thread matching through a `Pattern_Handle`. Each one sits on its own cache line, as it is
+// written by its thread while the publisher reads it. Heap arrays of readers must be allocated
+// with `aligned_alloc(64, ...)` to keep this.
+typedef struct __attribute__((aligned(64))) {
+    uint64_t epoch;  // Last publication seen at a quiescent state, `UINT64_MAX` when offline
+} Pattern_Reader;
+
+// Publishes a program or a set to threads matching concurrently. Readers get the current value
+// with a single atomic load and no lock. A replaced value stays valid until every reader has gone
+// through a quiescent state (a point where it holds no value got from the handle) since it was
+// replaced. The storage of the readers is provided by the caller.
+typedef struct {
+    void* value;
+    uint64_t epoch;  // Number of publications
+    Pattern_Reader* readers;
+    size_t reader_count;
+} Pattern_Handle;
+#endif
+
+// Progress of a substitution, see `pattern_gsub`
+typedef struct {
+    char* out;         // Output buffer, can be NULL to only compute the length of the output
+    size_t out_size;   // Size of the output buffer
+    size_t out_len;    // Length of the output, can exceed `out_size` (in which case it's truncated)
+    size_t count;      // Number of substitutions made
+    size_t pos;        // Offset in the data where the substitution continues
+    bool after_match;  // `pos` is the end of a substitution, an empty match isn't allowed there
+} Pattern_Gsub;
+
 // Try to match some data (or cstring) with `pattern` starting from `starting_pos` in the data.
 // If `starting_pos` is negative, it will be interpreted as an offset from the end of the data.
 // Returns the match status (PATTERN_MATCH, PATTERN_NO_MATCH, or PATTERN_ERROR).
@@ -131,6 +304,135 @@ Pattern_Status pattern_match_cstr(Pattern_State* ps, const char* str, const char
 Pattern_Status pattern_match_cstr_ex(Pattern_State* ps, const char* str, const char* pattern,
                                      ptrdiff_t starting_pos);
 
+// Compiles `pattern` into `prog`. The pattern string must outlive the program.
+// Character classes of fixed-length patterns, and of the first item other patterns start with,
+// are evaluated once at compile time with the current locale: recompile after changing it.
+void pattern_compile(Pattern_Program* prog, const char* pattern);
+// Same as `pattern_compile`, enabling the syntax extensions in `flags` (see `Pattern_Flags`)
+void pattern_compile_ex(Pattern_Program* prog, const char* pattern, int flags);
+// Records the character classes of the current locale in `locale`, calling the ctype functions
+// once per byte. A snapshot is never modified by the library, so it can be shared by threads.
+// To follow a change of locale take a new snapshot, rather than overwriting one in use.
+void pattern_locale_snapshot(Pattern_Locale* locale);
+// Same as `pattern_compile_ex`, classes being those of `locale` (which must outlive the program)
+// instead of the current locale. Matching looks them up in its tables, without ctype calls.
+void pattern_compile_locale(Pattern_Program* prog, const char* pattern, int flags,
+                            const Pattern_Locale* locale);
+// Writes the canonical form of `pattern` to `out` (NUL terminated, truncated to `out_size`) and
+// returns its length. Equivalent patterns written differently (`[0-9]` and `%d`, `[ab]` and
+// `[ba]`, `%,` and `,`, ...) share the same canonical form.
+size_t pattern_canonicalize(const char* pattern, char* out, size_t out_size);
+// Returns a stable 64-bit hash of the canonical form of `pattern`
+uint64_t pattern_fingerprint(const char* pattern);
+// Same as `pattern_match` and `pattern_match_ex`, but using a compiled pattern
+Pattern_Status pattern_match_program(Pattern_State* ps, const Pattern_Program* prog,
+                                     const void* data, size_t len);
+Pattern_Status pattern_match_program_ex(Pattern_State* ps, const Pattern_Program* prog,
+                                        const void* data, size_t len, ptrdiff_t starting_pos);
+// Searches for a match lying within `[start, end)` of the data and starting at most `max_scan`
+// bytes after `start` (`PATTERN_UNBOUNDED` for no limit). Unlike matching a sub-span, the bytes
+// around the range stay visible: `%f` sees the characters preceding and following it, while `^`
+// anchors at `start` and `$` at `end`. Capture positions are offsets in the whole data.
+Pattern_Status pattern_match_range(Pattern_State* ps, const Pattern_Program* prog,
+                                   const void* data, size_t len, size_t start, size_t end,
+                                   size_t max_scan);
+
+// Prepares `set` to hold up to `capacity` patterns in `entries` and `order`, which must outlive it
+void pattern_set_init(Pattern_Set* set, Pattern_Set_Entry* entries, size_t* order,
+                      size_t capacity);
+// Compiles `pattern` with `flags` (see `pattern_compile_ex`) and appends it to the set.
+// Returns its index, or `PATTERN_SET_NONE` if the set is full. Only the new pattern is compiled.
+size_t pattern_set_add(Pattern_Set* set, const char* pattern, int flags);
+// Compiles `patterns[begin]` to `patterns[end - 1]` with `flags` into the free entries of the set,
+// pattern `i` going to entry `set->count + i`, without adding them to the set. Each call only
+// writes the entries of its range, so that threads can compile disjoint ranges of a large set at
+// the same time. Patterns beyond the capacity of the set are ignored.
+void pattern_set_compile_range(const Pattern_Set* set, const char* const* patterns, int flags,
+                               size_t begin, size_t end);
+// Adds the `count` patterns compiled by `pattern_set_compile_range` to the set, in the order of
+// `patterns`: the set is the same whatever the ranges and the threads compiling them. Returns the
+// index of the first one, or `PATTERN_SET_NONE` if they don't fit.
+size_t pattern_set_commit(Pattern_Set* set, size_t count);
+// Removes the pattern at `idx`, which is no longer verified. Indices of the other patterns don't
+// change, its room being reclaimed by `pattern_set_compact`. Returns false if there is no such
+// pattern.
+bool pattern_set_remove(Pattern_Set* set, size_t idx);
+// Drops the removed patterns, keeping the others in the same declaration and learned order.
+// If `remap` is not NULL it must have room for `set->count` indices, receiving the new index of
+// each pattern (or `PATTERN_SET_NONE` for the removed ones). Returns the new number of patterns.
+size_t pattern_set_compact(Pattern_Set* set, size_t* remap);
+// Matches the data against the set, storing the index of the first matching pattern in declaration
+// order in `winner` (or `PATTERN_SET_NONE`) and its captures in `ps`. Patterns are verified in
+// declaration order: all the ones declared before the winner have to be ruled out anyway. A
+// malformed pattern verified before a match makes the match fail with PATTERN_ERROR, its index
+// being stored in `winner`. Every `reorder_interval` matches the learned order is updated.
+Pattern_Status pattern_set_match(Pattern_Set* set, Pattern_State* ps, const void* data, size_t len,
+                                 size_t* winner);
+// Same as `pattern_set_match`, but patterns are verified in the learned order and the winner is
+// the first one matching in that order. When no input can match more than one pattern (as in most
+// classifiers) it is the same winner, found without verifying the patterns that rarely win.
+Pattern_Status pattern_set_match_any(Pattern_Set* set, Pattern_State* ps, const void* data,
+                                     size_t len, size_t* winner);
+// Sorts the learned order by the ratio of hits to cost, highest first
+void pattern_set_reorder(Pattern_Set* set);
+// Copies the learned order (`set->count` indices) to `order`, to persist it across restarts
+void pattern_set_export_order(const Pattern_Set* set, size_t* order);
+// Restores an order exported by `pattern_set_export_order`. Returns false, leaving the set
+// untouched, if `order` isn't a permutation of the `count` patterns of the set.
+bool pattern_set_import_order(Pattern_Set* set, const size_t* order, size_t count);
+
+#ifdef PATTERN_HAS_HANDLE
+// Prepares `handle` to publish `value` (a `Pattern_Program*` or `Pattern_Set*`) to `reader_count`
+// readers, which start online
+void pattern_handle_init(Pattern_Handle* handle, void* value, Pattern_Reader* readers,
+                         size_t reader_count);
+// Returns the current value. Sets read by many threads must have their statistics disabled
+// (`reorder_interval` of 0), as matching would update them otherwise.
+void* pattern_handle_get(const Pattern_Handle* handle);
+// Reports that `reader` no longer uses any value got from the handle, typically between requests
+void pattern_handle_quiescent(Pattern_Handle* handle, size_t reader);
+// Reports that `reader` stops getting values (while idle or blocked), so that it doesn't delay
+// reclamation. It must go back online before calling `pattern_handle_get` again.
+void pattern_handle_offline(Pattern_Handle* handle, size_t reader);
+void pattern_handle_online(Pattern_Handle* handle, size_t reader);
+// Replaces the value, returning a ticket for the previous one which is stored in `old`.
+// Publications must not run concurrently with each other.
+uint64_t pattern_handle_publish(Pattern_Handle* handle, void* value, void** old);
+// Whether the value replaced by the publication of `ticket` is no longer used by any reader, so
+// that it can be freed or reused
+bool pattern_handle_reclaimable(const Pattern_Handle* handle, uint64_t ticket);
+#endif
+
+// Prepares `gs` to substitute the data starting from offset `pos`, writing into `out`
+void pattern_gsub_init(Pattern_Gsub* gs, char* out, size_t out_size, size_t pos);
+// Replaces all the matches of `prog` from `gs->pos` onwards with `repl`, copying the data in
+// between to the output, like Lua's `string.gsub`. In `repl`, `%0` is the whole match, `%1`-`%9`
+// are captures and `%%` is a literal `%`. The output is not NUL terminated.
+// Returns PATTERN_MATCH if any substitution was made, or PATTERN_ERROR with the error stored in
+// `ps`. Errors in `repl` are reported with `ps->pattern_base` pointing to it.
+Pattern_Status pattern_gsub(Pattern_State* ps, const Pattern_Program* prog, const void* data,
+                            size_t len, const char* repl, Pattern_Gsub* gs);
+// Same as `pattern_gsub`, but only replaces matches starting before `end`, leaving `gs` where a
+// serial substitution would resume. The whole data is still visible to the pattern.
+Pattern_Status pattern_gsub_range(Pattern_State* ps, const Pattern_Program* prog,
+                                  const void* data, size_t len, size_t end, const char* repl,
+                                  Pattern_Gsub* gs);
+
+// Called for every matching line by `pattern_match_lines`. Return false to stop scanning.
+typedef bool (*Pattern_Line_Callback)(void* userdata, size_t line, const Pattern_State* ps);
+
+// Matches `prog` against each line of the data (without its terminating '\n') in order, invoking
+// `callback` for the matching ones. Lines are numbered starting from `first_line`.
+// Returns PATTERN_MATCH if any line matched, or PATTERN_ERROR with the error stored in `ps`.
+Pattern_Status pattern_match_lines(Pattern_State* ps, const Pattern_Program* prog,
+                                   const void* data, size_t len, size_t first_line,
+                                   Pattern_Line_Callback callback, void* userdata);
+// Returns the number of '\n' in the data
+size_t pattern_count_newlines(const void* data, size_t len);
+// Returns the offset of the first line starting at or after `pos`, or `len` if there is none.
+// Useful to split data into chunks of whole lines.
+size_t pattern_line_boundary(const void* data, size_t len, size_t pos);
+
 // Returns true if capture `idx` is a position-only capture (i.e. `()`)
 bool pattern_is_position_capture(const Pattern_State* ps, int idx);
 // Gets the offset from the start of the string where the capture `idx` starts
@@ -149,12 +451,31 @@ void pattern_print_error(FILE* stream, const Pattern_State* ps);
 #include <stdlib.h>
 #include <string.h>
 
+#define PATTERN_HASH_BASE          0x100000001b3ull
+#define PATTERN_SWAR_ONES          0x0101010101010101ull
+#define PATTERN_SWAR_LOW7          0x7f7f7f7f7f7f7f7full
+#define PATTERN_SWAR_HIGHS         0x8080808080808080ull
+#define PATTERN_SWAR_SAMPLE        4096  // Bytes sampled to choose how to count newlines
+#define PATTERN_SWAR_MAX_LINE      128   // Longer lines are counted with `memchr`
+#define PATTERN_CLASS_BIT(cls)     (1ul << ((cls) - 'a'))
+#define PATTERN_CLASS_LETTERS                                                                  \
+    (PATTERN_CLASS_BIT('a') | PATTERN_CLASS_BIT('c') | PATTERN_CLASS_BIT('d') |                \
+     PATTERN_CLASS_BIT('g') | PATTERN_CLASS_BIT('l') | PATTERN_CLASS_BIT('p') |                \
+     PATTERN_CLASS_BIT('s') | PATTERN_CLASS_BIT('u') | PATTERN_CLASS_BIT('w') |                \
+     PATTERN_CLASS_BIT('x') | PATTERN_CLASS_BIT('z'))
+#define PATTERN_SHIFT_AND_MIN_SCAN 256
+#define PATTERN_STRINGIFY_(x)      #x
+#define PATTERN_STRINGIFY(x)       PATTERN_STRINGIFY_(x)  // Expands `x` before quoting it
+
 static void pattern_init(Pattern_State* ps, const void* data, size_t len, const char* pattern) {
     ps->error = PATTERN_ERR_NONE;
     ps->error_loc = 0;
     ps->data.data = (const char*)data;
     ps->data.size = len;
+    ps->lookahead = 0;
     ps->pattern_base = pattern;
+    ps->flags = 0;
+    ps->locale = NULL;
     ps->capture_count = 1;
     ps->captures[0].data = (const char*)data;
     ps->captures[0].size = PATTERN_CAPTURE_UNFINISHED;
@@ -176,49 +497,153 @@ static bool pattern_is_at_pattern_end(const char* pattern_ptr) {
 
 static const char* pattern_match_start(Pattern_State* ps, const char* str, const char* pattern);
 
-static bool pattern_match_class(char c, char cls) {
-    bool res;
-    switch(tolower(cls)) {
+// Word-at-a-time (SWAR) kernels, scanning 8 bytes per step in portable C. Masks have the high bit
+// of a byte set when the byte passes the test, without false positives from carries between
+// bytes, so that they don't depend on the byte order.
+
+static uint64_t pattern_swar_load(const char* ptr) {
+    uint64_t word;
+    memcpy(&word, ptr, sizeof(word));
+    return word;
+}
+
+// Bytes of `word` equal to `c`
+static uint64_t pattern_swar_eq(uint64_t word, unsigned char c) {
+    uint64_t x = word ^ (PATTERN_SWAR_ONES * c);
+    return ~(((x & PATTERN_SWAR_LOW7) + PATTERN_SWAR_LOW7) | x | PATTERN_SWAR_LOW7);
+}
+
+// Bytes of `word` between `lo` and `hi` (both ASCII)
+static uint64_t pattern_swar_between(uint64_t word, unsigned char lo, unsigned char hi) {
+    uint64_t x = word & PATTERN_SWAR_LOW7;
+    uint64_t at_least_lo = x + PATTERN_SWAR_ONES * (0x80 - lo);
+    uint64_t above_hi = x + PATTERN_SWAR_ONES * (0x7f - hi);
+    return at_least_lo & ~above_hi & ~word & PATTERN_SWAR_HIGHS;
+}
+
+// Returns the first byte of `[str, end)` different from `c`, or `end`
+static const char* pattern_skip_byte(const char* str, const char* end, unsigned char c) {
+    while(end - str >= 8 && pattern_swar_eq(pattern_swar_load(str), c) == PATTERN_SWAR_HIGHS) {
+        str += 8;
+    }
+    while(str < end && (unsigned char)*str == c) str++;
+    return str;
+}
+
+// Returns the first byte of `[str, end)` not between `lo` and `hi` (both ASCII), or `end`
+static const char* pattern_skip_range(const char* str, const char* end, unsigned char lo,
+                                      unsigned char hi) {
+    while(end - str >= 8 &&
+          pattern_swar_between(pattern_swar_load(str), lo, hi) == PATTERN_SWAR_HIGHS) {
+        str += 8;
+    }
+    while(str < end && lo <= (unsigned char)*str && (unsigned char)*str <= hi) str++;
+    return str;
+}
+
+// Returns the first byte of `[str, end)` equal to `a` or `b`, or `end`
+static const char* pattern_find_either(const char* str, const char* end, unsigned char a,
+                                       unsigned char b) {
+    while(end - str >= 8) {
+        uint64_t word = pattern_swar_load(str);
+        if(pattern_swar_eq(word, a) | pattern_swar_eq(word, b)) break;
+        str += 8;
+    }
+    while(str < end && (unsigned char)*str != a && (unsigned char)*str != b) str++;
+    return str;
+}
+
+// Returns the number of bytes of `[str, end)` equal to `c`
+static size_t pattern_count_byte(const char* str, const char* end, unsigned char c) {
+    size_t count = 0;
+    while(end - str >= 8) {
+        // Bytes of `sums` count the matches at their position over up to 255 words, then their
+        // sum is taken in 16-bit lanes accumulating in the top lane
+        uint64_t sums = 0;
+        for(int i = 0; i < 255 && end - str >= 8; i++, str += 8) {
+            sums += pattern_swar_eq(pattern_swar_load(str), c) >> 7;
+        }
+        uint64_t pairs = (sums & 0x00ff00ff00ff00ffull) + ((sums >> 8) & 0x00ff00ff00ff00ffull);
+        count += (size_t)((pairs * 0x0001000100010001ull) >> 48);
+    }
+    for(; str < end; str++) count += (unsigned char)*str == c;
+    return count;
+}
+
+// Returns the first occurrence of `lit` starting in `[str, last_start]`, which must leave room for
+// all of `lit`, or NULL. Single bytes are left to `memchr`, which libc implementations vectorize.
+static const char* pattern_find_literal(const char* str, const char* last_start, const char* lit,
+                                        size_t len) {
+    if(str > last_start) return NULL;
+    if(len == 1) return (const char*)memchr(str, *lit, last_start - str + 1);
+
+    // Test the first and last bytes of the literal at 8 starting positions at once, the rare
+    // candidates passing both are then compared in full
+    unsigned char first = lit[0], last = lit[len - 1];
+    for(; last_start - str >= 8; str += 8) {
+        uint64_t candidates = pattern_swar_eq(pattern_swar_load(str), first) &
+                              pattern_swar_eq(pattern_swar_load(str + len - 1), last);
+        if(!candidates) continue;
+        for(int i = 0; i < 8; i++) {
+            if((unsigned char)str[i] == first && (unsigned char)str[i + len - 1] == last &&
+               memcmp(str + i + 1, lit + 1, len - 2) == 0) {
+                return str + i;
+            }
+        }
+    }
+    for(; str <= last_start; str++) {
+        if(memcmp(str, lit, len) == 0) return str;
+    }
+    return NULL;
+}
+
+// Calls the ctype function of class `cls` (lowercase), `pattern_match_class` handling the others
+static bool pattern_ctype_class(unsigned char c, char cls) {
+    switch(cls) {
     case 'a':
-        res = isalpha(c);
-        break;
+        return isalpha(c);
     case 'c':
-        res = iscntrl(c);
-        break;
+        return iscntrl(c);
     case 'd':
-        res = isdigit(c);
-        break;
+        return isdigit(c);
     case 'l':
-        res = islower(c);
-        break;
+        return islower(c);
     case 'p':
-        res = ispunct(c);
-        break;
+        return ispunct(c);
     case 's':
-        res = isspace(c);
-        break;
+        return isspace(c);
     case 'u':
-        res = isupper(c);
-        break;
+        return isupper(c);
     case 'w':
-        res = isalnum(c);
-        break;
+        return isalnum(c);
     case 'x':
-        res = isxdigit(c);
-        break;
+        return isxdigit(c);
     case 'g':
-        res = isprint(c) && !isspace(c);
-        break;
-    case 'z':
-        res = c == '\0';
-        break;
+        return isprint(c) && !isspace(c);
     default:
-        return c == cls;
+        return c == '\0';
     }
-    return isupper(cls) ? !res : res;
 }
 
-static bool pattern_match_custom_class(char c, const char* pattern_ptr, const char* class_end) {
+static bool pattern_is_class_escape(char cls) {
+    // Letters are ASCII, so that setting the case bit gives the lowercase letter
+    unsigned char lower = (unsigned char)cls | 0x20;
+    return lower >= 'a' && lower <= 'z' && (PATTERN_CLASS_LETTERS & PATTERN_CLASS_BIT(lower));
+}
+
+// Classes are looked up in `locale` if not NULL, otherwise the ctype functions are called. Bytes
+// are classified as `unsigned char`, like Lua does.
+static bool pattern_match_class(const Pattern_Locale* locale, char c, char cls) {
+    if(!pattern_is_class_escape(cls)) return c == cls;
+    unsigned char lower = (unsigned char)cls | 0x20;
+    bool res = locale ? (locale->classes[(unsigned char)c] & PATTERN_CLASS_BIT(lower)) != 0
+                      : pattern_ctype_class((unsigned char)c, (char)lower);
+    // Uppercase classes are negated
+    return (unsigned char)cls == lower ? res : !res;
+}
+
+static bool pattern_match_custom_class(const Pattern_Locale* locale, char c,
+                                       const char* pattern_ptr, const char* class_end) {
     bool ret = true;
     if(pattern_ptr[1] == '^') {
         ret = false;
@@ -228,7 +653,7 @@ static bool pattern_match_custom_class(char c, const char* pattern_ptr, const ch
     while(++pattern_ptr < class_end) {
         if(*pattern_ptr == PATTERN_ESCAPE) {
             pattern_ptr++;
-            if(pattern_match_class(c, *pattern_ptr)) {
+            if(pattern_match_class(locale, c, *pattern_ptr)) {
                 return ret;
             }
         } else if(pattern_ptr[1] == '-' && pattern_ptr + 2 < class_end) {
@@ -244,19 +669,41 @@ static bool pattern_match_custom_class(char c, const char* pattern_ptr, const ch
     return !ret;
 }
 
-static bool pattern_match_class_or_char(char c, const char* pattern, const char* class_end) {
+static bool pattern_match_class_or_char(const Pattern_Locale* locale, char c, const char* pattern,
+                                        const char* class_end) {
     switch(*pattern) {
     case '.':
         return true;
     case PATTERN_ESCAPE:
-        return pattern_match_class(c, pattern[1]);
+        return pattern_match_class(locale, c, pattern[1]);
     case '[':
-        return pattern_match_custom_class(c, pattern, class_end - 1);
+        return pattern_match_custom_class(locale, c, pattern, class_end - 1);
     default:
         return c == *pattern;
     }
 }
 
+// Returns the first byte of `[str, end)` not matched by the single character, class or set `item`
+// (ending at `item_end`), or `end`. Runs of a byte or of digits are scanned a word at a time.
+static const char* pattern_skip_item(const Pattern_Locale* locale, const char* str,
+                                     const char* end, const char* item, const char* item_end) {
+    switch(*item) {
+    case '.':
+        return end;
+    case '[':
+        break;
+    case PATTERN_ESCAPE:
+        // `isdigit` only accepts '0' to '9' whatever the locale
+        if(item[1] == 'd') return pattern_skip_range(str, end, '0', '9');
+        if(!pattern_is_class_escape(item[1])) return pattern_skip_byte(str, end, item[1]);
+        break;
+    default:
+        return pattern_skip_byte(str, end, *item);
+    }
+    while(str < end && pattern_match_class_or_char(locale, *str, item, item_end)) str++;
+    return str;
+}
+
 static const char* pattern_match_balanced(Pattern_State* ps, const char* string_ptr,
                                           const char* pattern_ptr) {
     if(pattern_is_at_pattern_end(&pattern_ptr[2]) || pattern_is_at_pattern_end(&pattern_ptr[3])) {
@@ -271,12 +718,13 @@ static const char* pattern_match_balanced(Pattern_State* ps, const char* string_
         return NULL;
     }
 
+    const char* end = ps->data.data + ps->data.size;
     string_ptr++;
     int count = 1;
-    while(!pattern_is_at_end(ps, string_ptr)) {
+    while((string_ptr = pattern_find_either(string_ptr, end, open, close)) < end) {
         if(*string_ptr == open) {
             count++;
-        } else if(*string_ptr == close) {
+        } else {
             count--;
             if(count == 0) {
                 return pattern_match_start(ps, string_ptr + 1, pattern_ptr + 4);
@@ -315,9 +763,10 @@ static const char* pattern_match_frontier(Pattern_State* ps, const char* string_
     const char* class_end = class_ptr;
 
     char prev_char = (string_ptr > ps->data.data) ? string_ptr[-1] : '\0';
-    char curr_char = pattern_is_at_end(ps, string_ptr) ? '\0' : *string_ptr;
-    bool prev_in_set = pattern_match_custom_class(prev_char, class_start, class_end);
-    bool curr_in_set = pattern_match_custom_class(curr_char, class_start, class_end);
+    const char* visible_end = ps->data.data + ps->data.size + ps->lookahead;
+    char curr_char = string_ptr < visible_end ? *string_ptr : '\0';
+    bool prev_in_set = pattern_match_custom_class(ps->locale, prev_char, class_start, class_end);
+    bool curr_in_set = pattern_match_custom_class(ps->locale, curr_char, class_start, class_end);
 
     if(!prev_in_set && curr_in_set) {
         return pattern_match_start(ps, string_ptr, class_end + 1);
@@ -387,12 +836,70 @@ static const char* pattern_match_capture(Pattern_State* ps, const char* string_p
     return string_ptr + capture_len;
 }
 
+// Returns the index of the back-reference starting at `pattern_ptr` if it refers to a finished,
+// non-empty capture, or -1 otherwise
+static int pattern_backref_target(const Pattern_State* ps, const char* pattern_ptr) {
+    if(*pattern_ptr != PATTERN_ESCAPE || !isdigit(pattern_ptr[1])) return -1;
+    int capture = strtol(pattern_ptr + 1, NULL, 10);
+    if(capture < 0 || capture >= ps->capture_count || ps->captures[capture].size <= 0) return -1;
+    return capture;
+}
+
+// Polynomial hash of `len` bytes, visited starting from `first` and moving by `step`
+static uint64_t pattern_hash(const char* first, size_t len, ptrdiff_t step) {
+    uint64_t h = 0;
+    for(size_t i = 0; i < len; i++, first += step) {
+        h = h * PATTERN_HASH_BASE + (unsigned char)*first;
+    }
+    return h;
+}
+
+// Slides a window hashed with `pattern_hash` by one byte, `top_pow` is `PATTERN_HASH_BASE^(len-1)`
+static uint64_t pattern_hash_roll(uint64_t h, uint64_t top_pow, char out, char in) {
+    return (h - (unsigned char)out * top_pow) * PATTERN_HASH_BASE + (unsigned char)in;
+}
+
+static uint64_t pattern_hash_top_pow(size_t len) {
+    uint64_t pow = 1;
+    while(--len) pow *= PATTERN_HASH_BASE;
+    return pow;
+}
+
+// Greedy repetition followed by a back-reference: instead of re-entering the matcher at every
+// candidate end of the repetition, keep a rolling hash of the capture-sized window that follows it
+// and only try the positions where the capture can actually repeat
+static const char* pattern_greedy_match_backref(Pattern_State* ps, const char* string_ptr,
+                                                ptrdiff_t i, const char* cls_end,
+                                                const Pattern_Substring* capture) {
+    ptrdiff_t len = capture->size;
+    ptrdiff_t available = ps->data.data + ps->data.size - string_ptr;
+    if(available < len) return NULL;
+    if(i > available - len) i = available - len;
+
+    // Hashed back to front, so that the window can be rolled towards the start of the data
+    uint64_t top_pow = pattern_hash_top_pow(len);
+    uint64_t target = pattern_hash(capture->data + len - 1, len, -1);
+    uint64_t h = pattern_hash(string_ptr + i + len - 1, len, -1);
+    for(;;) {
+        if(h == target) {
+            const char* res = pattern_match_start(ps, string_ptr + i, cls_end + 1);
+            if(res) return res;
+            if(ps->error) return NULL;
+        }
+        if(i == 0) return NULL;
+        i--;
+        h = pattern_hash_roll(h, top_pow, string_ptr[i + len], string_ptr[i]);
+    }
+}
+
 static const char* pattern_greedy_match(Pattern_State* ps, const char* string_ptr,
                                         const char* pattern_ptr, const char* cls_end) {
-    ptrdiff_t i = 0;
-    while(!pattern_is_at_end(ps, &string_ptr[i]) &&
-          pattern_match_class_or_char(string_ptr[i], pattern_ptr, cls_end)) {
-        i++;
+    const char* end = ps->data.data + ps->data.size;
+    ptrdiff_t i = pattern_skip_item(ps->locale, string_ptr, end, pattern_ptr, cls_end) - string_ptr;
+
+    int capture = pattern_backref_target(ps, cls_end + 1);
+    if(capture != -1) {
+        return pattern_greedy_match_backref(ps, string_ptr, i, cls_end, &ps->captures[capture]);
     }
 
     while(i >= 0) {
@@ -405,14 +912,46 @@ static const char* pattern_greedy_match(Pattern_State* ps, const char* string_pt
     return NULL;
 }
 
+// Lazy counterpart of `pattern_greedy_match_backref`
+static const char* pattern_lazy_match_backref(Pattern_State* ps, const char* string_ptr,
+                                              const char* pattern_ptr, const char* cls_end,
+                                              const Pattern_Substring* capture) {
+    ptrdiff_t len = capture->size;
+    const char* end = ps->data.data + ps->data.size;
+    if(end - string_ptr < len) return NULL;
+
+    uint64_t top_pow = pattern_hash_top_pow(len);
+    uint64_t target = pattern_hash(capture->data, len, 1);
+    uint64_t h = pattern_hash(string_ptr, len, 1);
+    for(;;) {
+        if(h == target) {
+            const char* res = pattern_match_start(ps, string_ptr, cls_end + 1);
+            if(res) return res;
+            if(ps->error) return NULL;
+        }
+        if(end - string_ptr == len ||
+           !pattern_match_class_or_char(ps->locale, *string_ptr, pattern_ptr, cls_end)) {
+            return NULL;
+        }
+        h = pattern_hash_roll(h, top_pow, string_ptr[0], string_ptr[len]);
+        string_ptr++;
+    }
+}
+
 static const char* pattern_lazy_match(Pattern_State* ps, const char* string_ptr,
                                       const char* pattern_ptr, const char* cls_end) {
+    int capture = pattern_backref_target(ps, cls_end + 1);
+    if(capture != -1) {
+        return pattern_lazy_match_backref(ps, string_ptr, pattern_ptr, cls_end,
+                                          &ps->captures[capture]);
+    }
+
     do {
         const char* res = pattern_match_start(ps, string_ptr, cls_end + 1);
         if(res) return res;
         if(ps->error) return NULL;
     } while(!pattern_is_at_end(ps, string_ptr) &&
-            pattern_match_class_or_char(*string_ptr++, pattern_ptr, cls_end));
+            pattern_match_class_or_char(ps->locale, *string_ptr++, pattern_ptr, cls_end));
 
     return NULL;
 }
@@ -446,13 +985,176 @@ static const char* pattern_find_class_end(Pattern_State* ps, const char* pattern
     }
 }
 
+// Parses the extended repetition `{n}`, `{n,}` or `{n,m}` at `pattern_ptr`, returning its end or
+// NULL if there is none (then `{` is a literal). Invalid bounds are returned as `min > max`.
+static const char* pattern_parse_counted(int flags, const char* pattern_ptr, size_t* min,
+                                         size_t* max) {
+    if(!(flags & PATTERN_EXTENDED) || *pattern_ptr++ != '{' || !isdigit(*pattern_ptr)) {
+        return NULL;
+    }
+
+    int min_digits = 0, max_digits = 0;
+    size_t lo = 0, hi;
+    for(; isdigit(*pattern_ptr); min_digits++) lo = lo * 10 + (*pattern_ptr++ - '0');
+    hi = lo;
+    if(*pattern_ptr == ',') {
+        pattern_ptr++;
+        hi = PATTERN_UNBOUNDED;
+        if(isdigit(*pattern_ptr)) {
+            for(hi = 0; isdigit(*pattern_ptr); max_digits++) hi = hi * 10 + (*pattern_ptr++ - '0');
+        }
+    }
+    if(*pattern_ptr != '}') return NULL;
+
+    // Counts are limited to 9 digits, so that they can't overflow
+    bool valid = min_digits <= 9 && max_digits <= 9 && lo <= hi;
+    *min = valid ? lo : 1;
+    *max = valid ? hi : 0;
+    return pattern_ptr + 1;
+}
+
+// Extended counted repetition: takes as many items as possible, up to `max`, then gives them back
+// one at a time down to `min`
+static const char* pattern_counted_match(Pattern_State* ps, const char* string_ptr,
+                                         const char* pattern_ptr, const char* class_end,
+                                         size_t min, size_t max, const char* counted_end) {
+    size_t available = ps->data.data + ps->data.size - string_ptr;
+    if(available < min) return NULL;
+    if(max > available) max = available;
+
+    size_t i = pattern_skip_item(ps->locale, string_ptr, string_ptr + max, pattern_ptr, class_end) -
+               string_ptr;
+    if(i < min) return NULL;
+
+    for(;; i--) {
+        const char* res = pattern_match_start(ps, string_ptr + i, counted_end);
+        if(res) return res;
+        if(ps->error || i == min) return NULL;
+    }
+}
+
+// Finds the extended literal alternation `(lit|lit|...)` starting at `pattern_ptr`, returning the
+// `)` closing it or NULL if the group doesn't alternate. `*valid` is set to false if there are more
+// than `PATTERN_MAX_ALTERNATIVES` or they aren't all sequences of literals.
+static const char* pattern_find_alternation(int flags, const char* pattern_ptr, bool* valid) {
+    if(!(flags & PATTERN_EXTENDED)) return NULL;
+
+    int alternatives = 1;
+    size_t min, max;
+    *valid = true;
+    for(const char* ptr = pattern_ptr + 1;; ptr++) {
+        switch(*ptr) {
+        case '\0':
+        case '(':
+            return NULL;
+        case ')':
+            if(alternatives > PATTERN_MAX_ALTERNATIVES) *valid = false;
+            return alternatives > 1 ? ptr : NULL;
+        case '|':
+            alternatives++;
+            break;
+        case PATTERN_ESCAPE:
+            if(pattern_is_at_pattern_end(&ptr[1])) return NULL;
+            if(isalnum((unsigned char)ptr[1])) *valid = false;
+            ptr++;
+            break;
+        case '[':
+            // Skipped as `pattern_find_class_end` does, sets can contain `(`, `)` and `|`
+            *valid = false;
+            if(*++ptr == '^') ptr++;
+            do {
+                if(pattern_is_at_pattern_end(ptr)) return NULL;
+                if(*ptr++ == PATTERN_ESCAPE && !pattern_is_at_pattern_end(ptr)) ptr++;
+            } while(*ptr != ']');
+            break;
+        case '.':
+        case '?':
+        case '*':
+        case '+':
+        case '-':
+            *valid = false;
+            break;
+        case '{':
+            if(pattern_parse_counted(flags, ptr, &min, &max)) *valid = false;
+            break;
+        }
+    }
+}
+
+// Extended literal alternation: a single pass over the data advances all the alternatives at once,
+// like a walk down a trie of them. The rest of the pattern is then tried after each alternative
+// that matched, in the order they are written, with the group captured as usual.
+static const char* pattern_match_alternation(Pattern_State* ps, const char* string_ptr,
+                                             const char* pattern_ptr, const char* group_end) {
+    if(ps->capture_count >= PATTERN_MAX_CAPTURES) {
+        pattern_set_error(ps, PATTERN_ERR_MAX_CAPTURES, pattern_ptr - ps->pattern_base);
+        return NULL;
+    }
+
+    const char* cursors[PATTERN_MAX_ALTERNATIVES];
+    size_t lens[PATTERN_MAX_ALTERNATIVES];
+    int count = 0;
+    cursors[count++] = pattern_ptr + 1;
+    for(const char* ptr = pattern_ptr + 1; ptr < group_end; ptr++) {
+        if(*ptr == PATTERN_ESCAPE) {
+            ptr++;
+        } else if(*ptr == '|') {
+            cursors[count++] = ptr + 1;
+        }
+    }
+
+    // Bit `i` of `alive` is set while alternative `i` matches the data read so far
+    size_t available = ps->data.data + ps->data.size - string_ptr;
+    uint32_t alive = 0xffffffffu >> (32 - count), matched = 0;
+    for(size_t i = 0; alive; i++) {
+        for(int alt = 0; alt < count; alt++) {
+            uint32_t bit = (uint32_t)1 << alt;
+            if(!(alive & bit)) continue;
+            const char* lit = cursors[alt];
+            bool escaped = *lit == PATTERN_ESCAPE;
+            if(*lit == '|' || *lit == ')') {
+                matched |= bit;
+                lens[alt] = i;
+                alive &= ~bit;
+            } else if(i < available && string_ptr[i] == lit[escaped]) {
+                cursors[alt] = lit + 1 + escaped;
+            } else {
+                alive &= ~bit;
+            }
+        }
+    }
+
+    Pattern_Substring* capture = &ps->captures[ps->capture_count++];
+    capture->data = string_ptr;
+    for(int alt = 0; alt < count; alt++) {
+        if(!(matched & ((uint32_t)1 << alt))) continue;
+        capture->size = lens[alt];
+        const char* res = pattern_match_start(ps, string_ptr + lens[alt], group_end + 1);
+        if(res) return res;
+        if(ps->error) break;
+    }
+    ps->capture_count--;
+    return NULL;
+}
+
 static const char* pattern_match_rep_operator(Pattern_State* ps, const char* string_ptr,
                                               const char* pattern_ptr) {
     const char* class_end = pattern_find_class_end(ps, pattern_ptr);
     if(!class_end) return NULL;
 
+    size_t min, max;
+    const char* counted_end = pattern_parse_counted(ps->flags, class_end, &min, &max);
+    if(counted_end) {
+        if(min > max) {
+            pattern_set_error(ps, PATTERN_ERR_INVALID_REPETITION, class_end - ps->pattern_base);
+            return NULL;
+        }
+        return pattern_counted_match(ps, string_ptr, pattern_ptr, class_end, min, max,
+                                     counted_end);
+    }
+
     bool is_match = !pattern_is_at_end(ps, string_ptr) &&
-                    pattern_match_class_or_char(*string_ptr, pattern_ptr, class_end);
+                    pattern_match_class_or_char(ps->locale, *string_ptr, pattern_ptr, class_end);
     switch(*class_end) {
     case '?': {
         const char* res;
@@ -477,8 +1179,16 @@ static const char* pattern_match_start(Pattern_State* ps, const char* string_ptr
     switch(*pattern_ptr) {
     case '\0':
         return string_ptr;
-    case '(':
-        return pattern_start_capture(ps, string_ptr, pattern_ptr);
+    case '(': {
+        bool valid;
+        const char* group_end = pattern_find_alternation(ps->flags, pattern_ptr, &valid);
+        if(!group_end) return pattern_start_capture(ps, string_ptr, pattern_ptr);
+        if(!valid) {
+            pattern_set_error(ps, PATTERN_ERR_INVALID_ALTERNATION, pattern_ptr - ps->pattern_base);
+            return NULL;
+        }
+        return pattern_match_alternation(ps, string_ptr, pattern_ptr, group_end);
+    }
     case ')':
         return pattern_end_capture(ps, string_ptr, pattern_ptr);
     case '$':
@@ -537,39 +1247,1505 @@ static void pattern_check_unclosed_captures(Pattern_State* ps) {
     }
 }
 
-Pattern_Status pattern_match(Pattern_State* ps, const void* data, size_t len, const char* pattern) {
-    return pattern_match_ex(ps, data, len, pattern, 0);
+static size_t pattern_add_len(size_t a, size_t b) {
+    return (a == PATTERN_UNBOUNDED || b == PATTERN_UNBOUNDED) ? PATTERN_UNBOUNDED : a + b;
 }
 
-Pattern_Status pattern_match_ex(Pattern_State* ps, const void* data, size_t len,
-                                const char* pattern, ptrdiff_t starting_pos) {
-    pattern_init(ps, data, len, pattern);
-    if(starting_pos < 0) starting_pos += len;  // negative starting_pos start from end of string
-    assert(starting_pos >= 0 && (size_t)starting_pos <= len && "starting_pos out of bounds");
+// Lengths of the shortest and longest alternatives of a valid extended alternation
+static void pattern_alternation_len(const char* pattern_ptr, const char* group_end, size_t* min,
+                                    size_t* max) {
+    size_t len = 0;
+    *min = PATTERN_UNBOUNDED, *max = 0;
+    for(const char* ptr = pattern_ptr + 1;; ptr++) {
+        if(ptr == group_end || *ptr == '|') {
+            if(len < *min) *min = len;
+            if(len > *max) *max = len;
+            if(ptr == group_end) return;
+            len = 0;
+        } else {
+            ptr += *ptr == PATTERN_ESCAPE;
+            len++;
+        }
+    }
+}
 
-    const char* str = (const char*)data + starting_pos;
-    if(*pattern == '^') {
-        const char* res = pattern_match_start(ps, str, pattern + 1);
-        pattern_check_unclosed_captures(ps);
-        if(ps->error) return PATTERN_ERROR;
-        if(res) {
-            ps->captures[0].size = res - str;
-            return PATTERN_MATCH;
+static const char* pattern_compile_frontier(const char* pattern_ptr) {
+    if(pattern_ptr[2] != '[') return NULL;
+    const char* class_ptr = &pattern_ptr[3];
+    while(!pattern_is_at_pattern_end(class_ptr) && *class_ptr != ']') {
+        if(*class_ptr == PATTERN_ESCAPE && !pattern_is_at_pattern_end(&class_ptr[1])) {
+            class_ptr += 2;
+        } else {
+            class_ptr++;
         }
+    }
+    return *class_ptr == ']' ? class_ptr + 1 : NULL;
+}
+
+static void pattern_append_suffix(Pattern_Program* prog, char c) {
+    if(prog->suffix_len == PATTERN_MAX_SUFFIX) {
+        // Only the last `PATTERN_MAX_SUFFIX` bytes are kept, they are still required to match
+        memmove(prog->suffix, prog->suffix + 1, PATTERN_MAX_SUFFIX - 1);
+        prog->suffix_len--;
+    }
+    prog->suffix[prog->suffix_len++] = c;
+}
+
+static void pattern_find_idiom(Pattern_Program* prog, Pattern_State* scratch) {
+    const char* pattern = prog->pattern;
+    if(strcmp(pattern, "^%s*(.-)%s*$") == 0) {
+        prog->idiom = PATTERN_IDIOM_TRIM;
+    } else if(strcmp(pattern, "%-?%d+%.?%d*") == 0) {
+        prog->idiom = PATTERN_IDIOM_NUMBER;
+    } else if(strcmp(pattern, "(%w+)=(%w+)") == 0) {
+        prog->idiom = PATTERN_IDIOM_KEY_VALUE;
     } else {
-        do {
-            const char* res = pattern_match_start(ps, str, pattern);
-            pattern_check_unclosed_captures(ps);
-            if(ps->error) return PATTERN_ERROR;
-            if(res) {
-                ps->captures[0].data = str;
-                ps->captures[0].size = res - str;
-                return PATTERN_MATCH;
+        const char* item = pattern + prog->anchored;
+        bool capture = *item == '(';
+        item += capture;
+        if(*item == '(' || *item == ')' || pattern_is_at_pattern_end(item)) return;
+        if(*item == PATTERN_ESCAPE && (isdigit(item[1]) || item[1] == 'b' || item[1] == 'f')) {
+            return;
+        }
+
+        const char* class_end = pattern_find_class_end(scratch, item);
+        if(*class_end++ != '+') return;
+        if(capture && *class_end++ != ')') return;
+        if(!pattern_is_at_pattern_end(class_end)) return;
+
+        prog->idiom = PATTERN_IDIOM_CLASS_RUN;
+        prog->idiom_item = item;
+    }
+}
+
+// Records the first item of the pattern, if no other item comes before it
+static void pattern_note_lead(Pattern_Program* prog, bool* at_start, const char* item,
+                              const char* item_end, char op) {
+    if(*at_start) {
+        prog->lead_item = item;
+        prog->lead_item_end = item_end;
+        prog->lead_op = op;
+    }
+    *at_start = false;
+}
+
+static void pattern_program_init(Pattern_Program* prog, const char* pattern, int flags) {
+    prog->pattern = pattern;
+    prog->flags = flags;
+    prog->locale = NULL;
+    prog->fingerprint = 0;
+    prog->idiom = PATTERN_IDIOM_NONE;
+    prog->idiom_item = NULL;
+    prog->fixed_len = 0;
+    prog->fixed_set_count = 0;
+    prog->well_formed = false;
+    prog->anchored = *pattern == '^';
+    prog->end_anchored = false;
+    prog->min_len = 0;
+    prog->max_len = 0;
+    prog->suffix_len = 0;
+    prog->prefix_len = 0;
+    prog->lead_item = prog->lead_item_end = NULL;
+    prog->lead_op = '\0';
+    prog->has_backrefs = false;
+    prog->has_first_bytes = false;
+}
+
+// Analysis of compiled programs, also run by one-shot matches missing the suffix of a trailing `$`
+static void pattern_analyze(Pattern_Program* prog, const char* pattern, int flags) {
+    pattern_program_init(prog, pattern, flags);
+    bool in_prefix = true, at_start = true;
+
+    // Scratch state used to validate items with the same routines the matcher uses
+    Pattern_State scratch;
+    pattern_init(&scratch, NULL, 0, pattern);
+
+    int capture_count = 1, open_count = 0;
+    int open_captures[PATTERN_MAX_CAPTURES];
+    bool closed_captures[PATTERN_MAX_CAPTURES] = {false};
+
+    const char* pattern_ptr = pattern + prog->anchored;
+    while(!pattern_is_at_pattern_end(pattern_ptr)) {
+        size_t item_min = 1, item_max = 1;
+        bool is_literal = false;
+
+        switch(*pattern_ptr) {
+        case '(': {
+            if(capture_count >= PATTERN_MAX_CAPTURES) return;
+            bool valid;
+            const char* group_end = pattern_find_alternation(flags, pattern_ptr, &valid);
+            if(group_end) {
+                if(!valid) return;
+                in_prefix = false;
+                pattern_note_lead(prog, &at_start, pattern_ptr, group_end + 1, '\0');
+                closed_captures[capture_count++] = true;
+                pattern_alternation_len(pattern_ptr, group_end, &item_min, &item_max);
+                prog->suffix_len = 0;
+                prog->min_len = pattern_add_len(prog->min_len, item_min);
+                prog->max_len = pattern_add_len(prog->max_len, item_max);
+                pattern_ptr = group_end + 1;
+            } else if(pattern_ptr[1] == ')') {
+                capture_count++;
+                pattern_ptr += 2;
+            } else {
+                open_captures[open_count++] = capture_count++;
+                pattern_ptr++;
+            }
+            continue;
+        }
+        case ')':
+            if(open_count == 0) return;
+            closed_captures[open_captures[--open_count]] = true;
+            pattern_ptr++;
+            continue;
+        case '$':
+            if(pattern_is_at_pattern_end(&pattern_ptr[1])) {
+                prog->end_anchored = true;
+                pattern_ptr++;
+                continue;
+            }
+            break;
+        case PATTERN_ESCAPE:
+            if(isdigit(pattern_ptr[1])) {
+                char* end;
+                long capture = strtol(pattern_ptr + 1, &end, 10);
+                if(capture < 1 || capture >= capture_count || !closed_captures[capture]) return;
+                item_min = 0, item_max = PATTERN_UNBOUNDED;
+                prog->has_backrefs = true;
+                pattern_note_lead(prog, &at_start, NULL, NULL, '\0');
+                pattern_ptr = end;
+            } else if(pattern_ptr[1] == 'b') {
+                if(pattern_is_at_pattern_end(&pattern_ptr[2]) ||
+                   pattern_is_at_pattern_end(&pattern_ptr[3])) {
+                    return;
+                }
+                item_min = 2, item_max = PATTERN_UNBOUNDED;
+                pattern_note_lead(prog, &at_start, pattern_ptr, pattern_ptr + 4, '\0');
+                pattern_ptr += 4;
+            } else if(pattern_ptr[1] == 'f') {
+                if(!(pattern_ptr = pattern_compile_frontier(pattern_ptr))) return;
+                item_min = 0, item_max = 0;
+                pattern_note_lead(prog, &at_start, NULL, NULL, '\0');
+            } else {
+                break;
+            }
+            in_prefix = false;
+            prog->suffix_len = 0;
+            prog->min_len = pattern_add_len(prog->min_len, item_min);
+            prog->max_len = pattern_add_len(prog->max_len, item_max);
+            continue;
+        }
+
+        const char* class_end = pattern_find_class_end(&scratch, pattern_ptr);
+        if(!class_end) return;
+
+        const char* item_end = class_end + 1;
+        const char* counted_end = pattern_parse_counted(flags, class_end, &item_min, &item_max);
+        if(counted_end) {
+            if(item_min > item_max) return;
+            item_end = counted_end;
+        } else {
+            switch(*class_end) {
+            case '?':
+                item_min = 0;
+                break;
+            case '*':
+            case '-':
+                item_min = 0, item_max = PATTERN_UNBOUNDED;
+                break;
+            case '+':
+                item_max = PATTERN_UNBOUNDED;
+                break;
+            default:
+                if(*pattern_ptr == PATTERN_ESCAPE) {
+                    is_literal = !pattern_is_class_escape(pattern_ptr[1]);
+                } else {
+                    is_literal = *pattern_ptr != '.' && *pattern_ptr != '[';
+                }
+                item_end = class_end;
+                break;
+            }
+        }
+
+        pattern_note_lead(prog, &at_start, pattern_ptr, class_end,
+                          counted_end ? '{' : item_end == class_end ? '\0' : *class_end);
+        if(is_literal) {
+            pattern_append_suffix(prog, class_end[-1]);
+            if(in_prefix && prog->prefix_len < PATTERN_MAX_PREFIX) {
+                prog->prefix[prog->prefix_len++] = class_end[-1];
             }
-        } while(!pattern_is_at_end(ps, str++));
+        } else {
+            in_prefix = false;
+            prog->suffix_len = 0;
+        }
+
+        prog->min_len = pattern_add_len(prog->min_len, item_min);
+        prog->max_len = pattern_add_len(prog->max_len, item_max);
+        pattern_ptr = item_end;
     }
 
-    return PATTERN_NO_MATCH;
+    if(open_count > 0) return;
+    if(!prog->end_anchored) prog->suffix_len = 0;
+    prog->well_formed = true;
+    pattern_find_idiom(prog, &scratch);
+}
+
+// Returns the end of the glob item at `glob`, which isn't at the end of the glob
+static const char* pattern_glob_item_end(const char* glob) {
+    if(*glob == '\\') return glob + (glob[1] ? 2 : 1);
+    if(*glob != '[') return glob + 1;
+
+    const char* ptr = glob + 1;
+    if(*ptr == '!' || *ptr == '^') ptr++;
+    if(*ptr == ']') ptr++;
+    for(; *ptr && *ptr != ']'; ptr++) {
+        if(*ptr == '\\' && ptr[1]) ptr++;
+    }
+    return *ptr == ']' ? ptr + 1 : glob + 1;
+}
+
+// Matches the members of a glob set, from after its `[` to its `]` (`set_end`)
+static bool pattern_glob_set_match(const char* set, const char* set_end, unsigned char c) {
+    bool negated = *set == '!' || *set == '^';
+    set += negated;
+    for(const char* ptr = set; ptr < set_end; ptr++) {
+        if(*ptr == '\\') ptr++;
+        unsigned char low = *ptr, high = low;
+        if(ptr + 2 < set_end && ptr[1] == '-') {
+            ptr += 2;
+            if(*ptr == '\\' && ptr + 1 < set_end) ptr++;
+            high = *ptr;
+        }
+        if(low <= c && c <= high) return !negated;
+    }
+    return negated;
+}
+
+static bool pattern_glob_item_match(const char* item, const char* item_end, char c) {
+    switch(*item) {
+    case '?':
+        return true;
+    case '[':
+        if(item_end - item > 1) return pattern_glob_set_match(item + 1, item_end - 1, c);
+        break;
+    case '\\':
+        if(item_end - item > 1) return c == item[1];
+        break;
+    }
+    return c == *item;
+}
+
+// Every glob item but `*` matches a single byte: returns the end of the segment of items at `glob`
+// (the next `*` or the end of the glob), storing the number of bytes it matches in `len` and the
+// number of plain literal bytes it starts with in `literal_len`
+static const char* pattern_glob_segment(const char* glob, size_t* len, size_t* literal_len) {
+    *len = *literal_len = 0;
+    bool literal = true;
+    while(*glob && *glob != '*') {
+        literal = literal && *glob != '?' && *glob != '[' && *glob != '\\';
+        *literal_len += literal;
+        (*len)++;
+        glob = pattern_glob_item_end(glob);
+    }
+    return glob;
+}
+
+// Matches the segment of items at `glob` against the bytes at `str`, which has room for them
+static bool pattern_glob_segment_match(const char* glob, const char* str) {
+    while(*glob && *glob != '*') {
+        const char* item_end = pattern_glob_item_end(glob);
+        if(!pattern_glob_item_match(glob, item_end, *str++)) return false;
+        glob = item_end;
+    }
+    return true;
+}
+
+// Globs can't raise errors and always match the whole input, so the analysis reduces to lengths
+// and the literal suffix
+static void pattern_analyze_glob(Pattern_Program* prog, const char* glob, int flags) {
+    pattern_program_init(prog, glob, flags);
+    prog->anchored = prog->end_anchored = true;
+    while(*glob) {
+        if(*glob == '*') {
+            prog->max_len = PATTERN_UNBOUNDED;
+            prog->suffix_len = 0;
+            glob++;
+            continue;
+        }
+        const char* item_end = pattern_glob_item_end(glob);
+        if(*glob == '?' || (*glob == '[' && item_end - glob > 1)) {
+            prog->suffix_len = 0;
+        } else {
+            pattern_append_suffix(prog, item_end[-1]);
+        }
+        prog->min_len = pattern_add_len(prog->min_len, 1);
+        prog->max_len = pattern_add_len(prog->max_len, 1);
+        glob = item_end;
+    }
+    prog->well_formed = true;
+}
+
+static void pattern_byte_set_add(Pattern_Byte_Set* set, unsigned char c) {
+    set->bits[c >> 3] |= 1 << (c & 7);
+}
+
+static bool pattern_byte_set_has(const Pattern_Byte_Set* set, unsigned char c) {
+    return set->bits[c >> 3] & (1 << (c & 7));
+}
+
+// Builds the per-position byte sets of fixed-length patterns
+static void pattern_compile_fixed(Pattern_Program* prog) {
+    if(!prog->well_formed || prog->min_len != prog->max_len || prog->min_len == 0 ||
+       prog->min_len > PATTERN_MAX_FIXED_LEN) {
+        return;
+    }
+
+    Pattern_State scratch;
+    pattern_init(&scratch, NULL, 0, prog->pattern);
+
+    size_t len = 0;
+    bool valid;
+    const char* pattern_ptr = prog->pattern + prog->anchored;
+    while(!pattern_is_at_pattern_end(pattern_ptr)) {
+        switch(*pattern_ptr) {
+        case '(':
+            // Alternatives can't be told apart by per-position byte sets
+            if(pattern_find_alternation(prog->flags, pattern_ptr, &valid)) return;
+            pattern_ptr += pattern_ptr[1] == ')' ? 2 : 1;
+            continue;
+        case ')':
+            pattern_ptr++;
+            continue;
+        case '$':
+            if(pattern_is_at_pattern_end(&pattern_ptr[1])) {
+                pattern_ptr++;
+                continue;
+            }
+            break;
+        case PATTERN_ESCAPE:
+            // The only zero-length items left are frontier patterns, which aren't supported
+            if(pattern_ptr[1] == 'f') return;
+            break;
+        }
+
+        const char* class_end = pattern_find_class_end(&scratch, pattern_ptr);
+        Pattern_Byte_Set set;
+        memset(&set, 0, sizeof(set));
+        for(int c = 0; c < 256; c++) {
+            if(pattern_match_class_or_char(prog->locale, (char)c, pattern_ptr, class_end)) {
+                pattern_byte_set_add(&set, c);
+            }
+        }
+
+        int idx = 0;
+        while(idx < prog->fixed_set_count && memcmp(&prog->fixed_sets[idx], &set, sizeof(set))) {
+            idx++;
+        }
+        if(idx == prog->fixed_set_count) {
+            if(prog->fixed_set_count == PATTERN_MAX_FIXED_SETS) return;
+            prog->fixed_sets[prog->fixed_set_count++] = set;
+        }
+
+        // Items of fixed-length patterns can only be repeated by `{n}`, which adds `n` positions
+        size_t count, count_max;
+        const char* counted_end = pattern_parse_counted(prog->flags, class_end, &count, &count_max);
+        if(!counted_end) count = 1, counted_end = class_end;
+        for(size_t i = 0; i < count; i++) prog->fixed_class[len++] = idx;
+        pattern_ptr = counted_end;
+    }
+
+    prog->fixed_len = len;
+}
+
+// Collects the bytes a match can start with from the first item, if it can't be skipped. Only
+// searches that try every starting position use them.
+static void pattern_compile_first_bytes(Pattern_Program* prog) {
+    const char* item = prog->lead_item;
+    if(!prog->well_formed || prog->anchored || prog->idiom != PATTERN_IDIOM_NONE ||
+       prog->fixed_len > 0 || prog->prefix_len > 0) {
+        return;
+    }
+    if(!item || (prog->lead_op != '\0' && prog->lead_op != '+')) return;
+
+    Pattern_Byte_Set set;
+    memset(&set, 0, sizeof(set));
+    if(*item == '(') {
+        // Alternatives are literal sequences, an empty one can start anywhere
+        const char* alt = item + 1;
+        for(;;) {
+            if(*alt == '|' || *alt == ')') return;
+            pattern_byte_set_add(&set, alt[*alt == PATTERN_ESCAPE]);
+            while(*alt != '|' && *alt != ')') alt += *alt == PATTERN_ESCAPE ? 2 : 1;
+            if(*alt++ == ')') break;
+        }
+    } else if(item[0] == PATTERN_ESCAPE && item[1] == 'b') {
+        pattern_byte_set_add(&set, item[2]);
+    } else if(*item == '.') {
+        return;
+    } else if(item + 1 == prog->lead_item_end) {
+        pattern_byte_set_add(&set, *item);
+    } else {
+        for(int c = 0; c < 256; c++) {
+            if(pattern_match_class_or_char(prog->locale, (char)c, item, prog->lead_item_end)) {
+                pattern_byte_set_add(&set, c);
+            }
+        }
+    }
+    prog->first_bytes = set;
+    prog->has_first_bytes = true;
+}
+
+typedef struct {
+    char* out;
+    size_t out_size;
+    size_t len;
+    uint64_t hash;
+    int flags;
+} Pattern_Canon;
+
+static void pattern_canon_emit(Pattern_Canon* canon, char c) {
+    if(canon->len + 1 < canon->out_size) canon->out[canon->len] = c;
+    canon->len++;
+    canon->hash = (canon->hash ^ (unsigned char)c) * PATTERN_HASH_BASE;  // FNV-1a
+}
+
+static void pattern_canon_emit_escaped(Pattern_Canon* canon, char c, const char* specials) {
+    if(strchr(specials, c)) pattern_canon_emit(canon, PATTERN_ESCAPE);
+    pattern_canon_emit(canon, c);
+}
+
+// Literals are escaped only if they would otherwise be special, `{` and `|` being special in
+// extended mode
+static void pattern_canon_emit_literal(Pattern_Canon* canon, char c) {
+    bool extended = (canon->flags & PATTERN_EXTENDED) && (c == '{' || c == '|');
+    pattern_canon_emit_escaped(canon, c, extended ? "{|" : "^$*+?.([%-)");
+}
+
+static void pattern_canon_emit_count(Pattern_Canon* canon, size_t count) {
+    char digits[24];
+    int len = snprintf(digits, sizeof(digits), "%lu", (unsigned long)count);
+    for(int i = 0; i < len; i++) pattern_canon_emit(canon, digits[i]);
+}
+
+// Emits the shortest form of an extended repetition: `?`, `*` and `+` when they are equivalent,
+// nothing for `{1}`
+static void pattern_canon_counted(Pattern_Canon* canon, size_t min, size_t max) {
+    if(min == 0 && max == 1) {
+        pattern_canon_emit(canon, '?');
+    } else if(min <= 1 && max == PATTERN_UNBOUNDED) {
+        pattern_canon_emit(canon, min == 0 ? '*' : '+');
+    } else if(min != 1 || max != 1) {
+        pattern_canon_emit(canon, '{');
+        pattern_canon_emit_count(canon, min);
+        if(max != min) {
+            pattern_canon_emit(canon, ',');
+            if(max != PATTERN_UNBOUNDED) pattern_canon_emit_count(canon, max);
+        }
+        pattern_canon_emit(canon, '}');
+    }
+}
+
+static bool pattern_byte_set_has_range(const Pattern_Byte_Set* set, char lo, char hi) {
+    for(int c = lo; c <= hi; c++) {
+        if(!pattern_byte_set_has(set, c)) return false;
+    }
+    return true;
+}
+
+static void pattern_byte_set_remove_range(Pattern_Byte_Set* set, char lo, char hi) {
+    for(int c = lo; c <= hi; c++) {
+        set->bits[c >> 3] &= ~(1 << (c & 7));
+    }
+}
+
+// Emits the canonical form of the set between `[` and `close`. Literal bytes and ranges become a
+// byte set, digits are folded into `%d` or `%x` (the only classes not depending on the locale),
+// then classes and bytes are emitted in ascending order. With `bracketed` false, sets of a single
+// class or byte are emitted without brackets.
+static void pattern_canon_set(Pattern_Canon* canon, const char* class_start, const char* close,
+                              bool bracketed) {
+    Pattern_Byte_Set bytes, classes;
+    memset(&bytes, 0, sizeof(bytes));
+    memset(&classes, 0, sizeof(classes));
+
+    const char* pattern_ptr = class_start + 1;
+    bool negated = *pattern_ptr == '^';
+    if(negated) pattern_ptr++;
+
+    // Mirrors `pattern_match_custom_class`
+    while(pattern_ptr < close) {
+        if(*pattern_ptr == PATTERN_ESCAPE) {
+            char c = pattern_ptr[1];
+            pattern_byte_set_add(pattern_is_class_escape(c) ? &classes : &bytes, c);
+            pattern_ptr += 2;
+        } else if(pattern_ptr[1] == '-' && pattern_ptr + 2 < close) {
+            for(int c = 0; c < 256; c++) {
+                if(pattern_ptr[0] <= (char)c && (char)c <= pattern_ptr[2]) {
+                    pattern_byte_set_add(&bytes, c);
+                }
+            }
+            pattern_ptr += 3;
+        } else {
+            pattern_byte_set_add(&bytes, *pattern_ptr++);
+        }
+    }
+
+    bool digits = pattern_byte_set_has(&classes, 'd') ||
+                  pattern_byte_set_has_range(&bytes, '0', '9');
+    bool hex = pattern_byte_set_has(&classes, 'x') ||
+               (digits && pattern_byte_set_has_range(&bytes, 'a', 'f') &&
+                pattern_byte_set_has_range(&bytes, 'A', 'F'));
+    if(hex) {
+        pattern_byte_set_add(&classes, 'x');
+        classes.bits['d' >> 3] &= ~(1 << ('d' & 7));
+        pattern_byte_set_remove_range(&bytes, 'a', 'f');
+        pattern_byte_set_remove_range(&bytes, 'A', 'F');
+    } else if(digits) {
+        pattern_byte_set_add(&classes, 'd');
+    }
+    if(digits || hex) pattern_byte_set_remove_range(&bytes, '0', '9');
+
+    int class_count = 0, byte_count = 0, first_class = 0, first_byte = 0;
+    for(int c = 255; c >= 0; c--) {
+        if(pattern_byte_set_has(&classes, c)) class_count++, first_class = c;
+        if(pattern_byte_set_has(&bytes, c)) byte_count++, first_byte = c;
+    }
+
+    if(class_count == 0 && byte_count == 0) {
+        // Empty sets (`[b-a]`) have no bracketed form of their own
+        for(const char* c = class_start; c <= close; c++) pattern_canon_emit(canon, *c);
+        return;
+    }
+    if(!bracketed && class_count == 1 && byte_count == 0) {
+        pattern_canon_emit(canon, PATTERN_ESCAPE);
+        pattern_canon_emit(canon, negated ? first_class ^ ('a' ^ 'A') : first_class);
+        return;
+    }
+    if(!bracketed && !negated && class_count == 0 && byte_count == 1) {
+        pattern_canon_emit_literal(canon, first_byte);
+        return;
+    }
+
+    pattern_canon_emit(canon, '[');
+    if(negated) pattern_canon_emit(canon, '^');
+    for(int c = 0; c < 256; c++) {
+        if(pattern_byte_set_has(&classes, c)) {
+            pattern_canon_emit(canon, PATTERN_ESCAPE);
+            pattern_canon_emit(canon, c);
+        }
+    }
+    for(int c = 1; c < 256; c++) {
+        if(!pattern_byte_set_has(&bytes, c)) continue;
+        // Runs of plain ASCII bytes become ranges, where signed and unsigned chars agree
+        int run_end = c;
+        while(run_end + 1 < 128 && pattern_byte_set_has(&bytes, run_end + 1)) run_end++;
+        if(run_end - c >= 2 && !strchr("%]^-", c) && !strchr("%]^-", run_end)) {
+            pattern_canon_emit(canon, c);
+            pattern_canon_emit(canon, '-');
+            pattern_canon_emit(canon, run_end);
+            c = run_end;
+        } else {
+            pattern_canon_emit_escaped(canon, c, "%]^-");
+        }
+    }
+    pattern_canon_emit(canon, ']');
+}
+
+// Alternatives only have their literals canonicalized, their order matters
+static void pattern_canon_alternation(Pattern_Canon* canon, const char* pattern_ptr,
+                                      const char* group_end) {
+    pattern_canon_emit(canon, '(');
+    while(++pattern_ptr < group_end) {
+        if(*pattern_ptr == '|') {
+            pattern_canon_emit(canon, '|');
+        } else {
+            pattern_ptr += *pattern_ptr == PATTERN_ESCAPE;
+            pattern_canon_emit_literal(canon, *pattern_ptr);
+        }
+    }
+    pattern_canon_emit(canon, ')');
+}
+
+static void pattern_canon_pattern(Pattern_Canon* canon, const char* pattern) {
+    Pattern_Program prog;
+    pattern_analyze(&prog, pattern, canon->flags);
+
+    const char* pattern_ptr = pattern;
+    if(!prog.well_formed) {
+        // Malformed patterns are left as they are, their errors refer to the original text
+        while(*pattern_ptr) pattern_canon_emit(canon, *pattern_ptr++);
+        return;
+    }
+
+    Pattern_State scratch;
+    pattern_init(&scratch, NULL, 0, pattern);
+
+    bool valid;
+    const char* group_end;
+    if(prog.anchored) pattern_canon_emit(canon, *pattern_ptr++);
+    while(!pattern_is_at_pattern_end(pattern_ptr)) {
+        switch(*pattern_ptr) {
+        case '(':
+            group_end = pattern_find_alternation(canon->flags, pattern_ptr, &valid);
+            if(group_end) {
+                pattern_canon_alternation(canon, pattern_ptr, group_end);
+                pattern_ptr = group_end + 1;
+                continue;
+            }
+            pattern_canon_emit(canon, *pattern_ptr++);
+            continue;
+        case ')':
+            pattern_canon_emit(canon, *pattern_ptr++);
+            continue;
+        case '$':
+            if(pattern_is_at_pattern_end(&pattern_ptr[1])) {
+                pattern_canon_emit(canon, *pattern_ptr++);
+                continue;
+            }
+            break;
+        case PATTERN_ESCAPE:
+            if(isdigit(pattern_ptr[1])) {
+                pattern_canon_emit(canon, *pattern_ptr++);
+                while(isdigit(*pattern_ptr)) pattern_canon_emit(canon, *pattern_ptr++);
+                continue;
+            } else if(pattern_ptr[1] == 'b') {
+                for(int i = 0; i < 4; i++) pattern_canon_emit(canon, *pattern_ptr++);
+                continue;
+            } else if(pattern_ptr[1] == 'f') {
+                const char* frontier_end = pattern_compile_frontier(pattern_ptr);
+                pattern_canon_emit(canon, PATTERN_ESCAPE);
+                pattern_canon_emit(canon, 'f');
+                pattern_canon_set(canon, pattern_ptr + 2, frontier_end - 1, true);
+                pattern_ptr = frontier_end;
+                continue;
+            }
+            break;
+        }
+
+        const char* class_end = pattern_find_class_end(&scratch, pattern_ptr);
+        if(*pattern_ptr == '[') {
+            pattern_canon_set(canon, pattern_ptr, class_end - 1, false);
+        } else if(*pattern_ptr == PATTERN_ESCAPE && pattern_is_class_escape(pattern_ptr[1])) {
+            pattern_canon_emit(canon, PATTERN_ESCAPE);
+            pattern_canon_emit(canon, pattern_ptr[1]);
+        } else if(*pattern_ptr == '.') {
+            pattern_canon_emit(canon, '.');
+        } else {
+            pattern_canon_emit_literal(canon, class_end[-1]);
+        }
+
+        size_t count_min, count_max;
+        const char* counted_end = pattern_parse_counted(canon->flags, class_end, &count_min,
+                                                        &count_max);
+        if(counted_end) {
+            pattern_canon_counted(canon, count_min, count_max);
+            class_end = counted_end;
+        } else if(strchr("?*+-", *class_end) && !pattern_is_at_pattern_end(class_end)) {
+            pattern_canon_emit(canon, *class_end++);
+        }
+        pattern_ptr = class_end;
+    }
+}
+
+size_t pattern_canonicalize(const char* pattern, char* out, size_t out_size) {
+    Pattern_Canon canon = {out, out_size, 0, 0, 0};
+    pattern_canon_pattern(&canon, pattern);
+    if(out_size > 0) out[canon.len < out_size ? canon.len : out_size - 1] = '\0';
+    return canon.len;
+}
+
+// The flags are part of the hash, as they change the meaning of the canonical form
+static uint64_t pattern_fingerprint_ex(const char* pattern, int flags) {
+    Pattern_Canon canon = {NULL, 0, 0, 0xcbf29ce484222325ull ^ (uint64_t)flags, flags};
+    if(flags & PATTERN_GLOB) {
+        // Globs have no canonical form, they are hashed as written
+        for(; *pattern; pattern++) pattern_canon_emit(&canon, *pattern);
+        return canon.hash;
+    }
+    pattern_canon_pattern(&canon, pattern);
+    return canon.hash;
+}
+
+uint64_t pattern_fingerprint(const char* pattern) {
+    return pattern_fingerprint_ex(pattern, 0);
+}
+
+void pattern_compile(Pattern_Program* prog, const char* pattern) {
+    pattern_compile_ex(prog, pattern, 0);
+}
+
+void pattern_compile_ex(Pattern_Program* prog, const char* pattern, int flags) {
+    pattern_compile_locale(prog, pattern, flags, NULL);
+}
+
+void pattern_locale_snapshot(Pattern_Locale* locale) {
+    for(int c = 0; c < 256; c++) {
+        uint32_t classes = 0;
+        for(char cls = 'a'; cls <= 'z'; cls++) {
+            if((PATTERN_CLASS_LETTERS & PATTERN_CLASS_BIT(cls)) &&
+               pattern_match_class(NULL, (char)c, cls)) {
+                classes |= PATTERN_CLASS_BIT(cls);
+            }
+        }
+        locale->classes[c] = classes;
+    }
+}
+
+void pattern_compile_locale(Pattern_Program* prog, const char* pattern, int flags,
+                            const Pattern_Locale* locale) {
+    if(flags & PATTERN_GLOB) {
+        pattern_analyze_glob(prog, pattern, flags);
+        prog->locale = locale;
+    } else {
+        pattern_analyze(prog, pattern, flags);
+        // Before the byte sets of fixed-length patterns, which are evaluated with it
+        prog->locale = locale;
+        pattern_compile_fixed(prog);
+        pattern_compile_first_bytes(prog);
+    }
+    prog->fingerprint = pattern_fingerprint_ex(pattern, flags);
+}
+
+Pattern_Status pattern_match(Pattern_State* ps, const void* data, size_t len, const char* pattern) {
+    return pattern_match_ex(ps, data, len, pattern, 0);
+}
+
+Pattern_Status pattern_match_program(Pattern_State* ps, const Pattern_Program* prog,
+                                     const void* data, size_t len) {
+    return pattern_match_program_ex(ps, prog, data, len, 0);
+}
+
+// Narrows down the starting positions worth trying for a well-formed program, ignoring its suffix.
+// Returns false if no starting position can match.
+static bool pattern_narrow_starts(const Pattern_Program* prog, const char* data, size_t len,
+                                  const char** str, const char** last_start) {
+    size_t available = data + len - *str;
+    if(available < prog->min_len) return false;
+    if(*last_start > data + len - prog->min_len) *last_start = data + len - prog->min_len;
+
+    // With an end anchor, only the starting positions that can reach the end of the data are useful
+    if(prog->end_anchored && prog->max_len < available) {
+        if(prog->anchored) return false;
+        *str = data + len - prog->max_len;
+    }
+    return true;
+}
+
+static bool pattern_has_suffix(const Pattern_Program* prog, const char* data, size_t len) {
+    return memcmp(data + len - prog->suffix_len, prog->suffix, prog->suffix_len) == 0;
+}
+
+static bool pattern_match_fixed_window(const Pattern_Program* prog, const char* str) {
+    for(size_t i = 0; i < prog->fixed_len; i++) {
+        if(!pattern_byte_set_has(&prog->fixed_sets[prog->fixed_class[i]], str[i])) return false;
+    }
+    return true;
+}
+
+// Shift-And search over the windows starting in `[str, last_start]`: bit `i` of the state is set
+// if the last `i + 1` bytes match the first `i + 1` positions of the pattern
+static const char* pattern_shift_and(const Pattern_Program* prog, const char* str,
+                                     const char* last_start) {
+    uint64_t set_positions[PATTERN_MAX_FIXED_SETS] = {0};
+    for(size_t i = 0; i < prog->fixed_len; i++) {
+        set_positions[prog->fixed_class[i]] |= (uint64_t)1 << i;
+    }
+
+    uint64_t table[256];
+    for(int c = 0; c < 256; c++) {
+        table[c] = 0;
+        for(int set = 0; set < prog->fixed_set_count; set++) {
+            if(pattern_byte_set_has(&prog->fixed_sets[set], c)) table[c] |= set_positions[set];
+        }
+    }
+
+    uint64_t state = 0, found = (uint64_t)1 << (prog->fixed_len - 1);
+    const char* end = last_start + prog->fixed_len;
+    for(const char* ptr = str; ptr < end; ptr++) {
+        state = ((state << 1) | 1) & table[(unsigned char)*ptr];
+        if(state & found) return ptr - prog->fixed_len + 1;
+    }
+    return NULL;
+}
+
+// Finds the first window in `[str, last_start]` accepted by a fixed-length program
+static const char* pattern_find_fixed(const Pattern_Program* prog, const char* str,
+                                      const char* last_start) {
+    if(prog->fixed_len <= 64 && last_start - str >= PATTERN_SHIFT_AND_MIN_SCAN) {
+        return pattern_shift_and(prog, str, last_start);
+    }
+    for(; str <= last_start; str++) {
+        if(pattern_match_fixed_window(prog, str)) return str;
+    }
+    return NULL;
+}
+
+static void pattern_set_capture(Pattern_State* ps, int idx, const char* start, const char* end) {
+    ps->captures[idx].data = start;
+    ps->captures[idx].size = end - start;
+    if(idx >= ps->capture_count) ps->capture_count = idx + 1;
+}
+
+static const char* pattern_skip_class(const Pattern_State* ps, const char* str, char cls) {
+    const char* end = ps->data.data + ps->data.size;
+    if(cls == 'd') return pattern_skip_range(str, end, '0', '9');
+    while(str < end && pattern_match_class(ps->locale, *str, cls)) str++;
+    return str;
+}
+
+// Linear routines for the idioms, producing the same results as the matcher
+static Pattern_Status pattern_match_idiom(Pattern_State* ps, const Pattern_Program* prog,
+                                          const char* str, const char* last_start) {
+    const char* end = ps->data.data + ps->data.size;
+    if(prog->anchored) last_start = str;
+
+    switch(prog->idiom) {
+    case PATTERN_IDIOM_TRIM: {
+        // `%s*` takes all the leading spaces, `(.-)` stops at the last non space
+        const char* text_start = pattern_skip_class(ps, str, 's');
+        const char* text_end = end;
+        while(text_end > text_start && pattern_match_class(ps->locale, text_end[-1], 's')) {
+            text_end--;
+        }
+        pattern_set_capture(ps, 0, str, end);
+        pattern_set_capture(ps, 1, text_start, text_end);
+        return PATTERN_MATCH;
+    }
+    case PATTERN_IDIOM_CLASS_RUN: {
+        const char* class_end = pattern_find_class_end(ps, prog->idiom_item);
+        for(; str <= last_start; str++) {
+            if(pattern_match_class_or_char(ps->locale, *str, prog->idiom_item, class_end)) break;
+        }
+        if(str > last_start) return PATTERN_NO_MATCH;
+
+        const char* run_end =
+            pattern_skip_item(ps->locale, str + 1, end, prog->idiom_item, class_end);
+        pattern_set_capture(ps, 0, str, run_end);
+        if(prog->pattern[prog->anchored] == '(') {
+            pattern_set_capture(ps, 1, str, run_end);
+        }
+        return PATTERN_MATCH;
+    }
+    case PATTERN_IDIOM_NUMBER:
+        for(; str <= last_start; str++) {
+            bool is_minus = *str == '-' && str + 1 < end &&
+                            pattern_match_class(ps->locale, str[1], 'd');
+            if(is_minus || pattern_match_class(ps->locale, *str, 'd')) {
+                const char* num_end = pattern_skip_class(ps, str + is_minus, 'd');
+                if(num_end < end && *num_end == '.') {
+                    num_end = pattern_skip_class(ps, num_end + 1, 'd');
+                }
+                pattern_set_capture(ps, 0, str, num_end);
+                return PATTERN_MATCH;
+            }
+        }
+        return PATTERN_NO_MATCH;
+    case PATTERN_IDIOM_KEY_VALUE:
+        // A match starts at the first word (or the part of it past `str`) followed by `=` and
+        // another word
+        while(str <= last_start) {
+            if(!pattern_match_class(ps->locale, *str, 'w')) {
+                str++;
+                continue;
+            }
+            const char* key_end = pattern_skip_class(ps, str, 'w');
+            if(key_end + 1 < end && *key_end == '=' &&
+               pattern_match_class(ps->locale, key_end[1], 'w')) {
+                const char* value_end = pattern_skip_class(ps, key_end + 1, 'w');
+                pattern_set_capture(ps, 0, str, value_end);
+                pattern_set_capture(ps, 1, str, key_end);
+                pattern_set_capture(ps, 2, key_end + 1, value_end);
+                return PATTERN_MATCH;
+            }
+            str = key_end;
+        }
+        return PATTERN_NO_MATCH;
+    case PATTERN_IDIOM_NONE:
+        break;
+    }
+    assert(false && "Unreachable");
+    return PATTERN_NO_MATCH;
+}
+
+// Finds the leftmost position in `[str, last]` where the glob segment at `glob` matches, its plain
+// literal bytes first locating the candidates
+static const char* pattern_glob_find_segment(const char* glob, size_t literal_len, const char* str,
+                                             const char* last) {
+    for(; str <= last; str++) {
+        if(literal_len > 0 && !(str = pattern_find_literal(str, last, glob, literal_len))) break;
+        if(pattern_glob_segment_match(glob, str)) return str;
+    }
+    return NULL;
+}
+
+// Matches a glob against the whole of `[str, end)`. The segments before the first `*` and after
+// the last one are compared with both ends of the input, and the ones in between are searched for
+// in order. Taking the leftmost occurrence of each segment leaves the most room to the following
+// ones, so there is no backtracking.
+static bool pattern_glob_match(const char* glob, const char* str, const char* end) {
+    size_t len, literal_len;
+    const char* segment_end = pattern_glob_segment(glob, &len, &literal_len);
+    if(len > (size_t)(end - str) || !pattern_glob_segment_match(glob, str)) return false;
+    if(!*segment_end) return len == (size_t)(end - str);
+    str += len;
+
+    for(glob = segment_end;;) {
+        while(*glob == '*') glob++;
+        segment_end = pattern_glob_segment(glob, &len, &literal_len);
+        if(len > (size_t)(end - str)) return false;
+        if(!*segment_end) return pattern_glob_segment_match(glob, end - len);
+        str = pattern_glob_find_segment(glob, literal_len, str, end - len);
+        if(!str) return false;
+        str += len;
+        glob = segment_end;
+    }
+}
+
+// Whether the pattern starts with `X*`, `X+` or `X-`. Without back-references, the rest of the
+// pattern matches the same way wherever the match started.
+static bool pattern_has_lead_run(const Pattern_Program* prog) {
+    return prog->lead_item && !prog->has_backrefs &&
+           (prog->lead_op == '*' || prog->lead_op == '+' || prog->lead_op == '-');
+}
+
+static Pattern_Status pattern_match_starts(Pattern_State* ps, const Pattern_Program* prog,
+                                           const char* str, const char* last_start) {
+    const char* pattern = prog->pattern;
+    if(prog->flags & PATTERN_GLOB) {
+        const char* end = ps->data.data + ps->data.size;
+        if(!pattern_glob_match(pattern, str, end)) return PATTERN_NO_MATCH;
+        ps->captures[0].data = str;
+        ps->captures[0].size = end - str;
+        return PATTERN_MATCH;
+    }
+    if(prog->idiom != PATTERN_IDIOM_NONE) return pattern_match_idiom(ps, prog, str, last_start);
+    if(prog->fixed_len > 0) {
+        // The byte sets decide whether a window matches, run the matcher once to fill captures
+        str = pattern_find_fixed(prog, str, prog->anchored ? str : last_start);
+        if(!str) return PATTERN_NO_MATCH;
+        last_start = str;
+    }
+    if(prog->anchored) {
+        const char* res = pattern_match_start(ps, str, pattern + 1);
+        pattern_check_unclosed_captures(ps);
+        if(ps->error) return PATTERN_ERROR;
+        if(res) {
+            ps->captures[0].data = str;
+            ps->captures[0].size = res - str;
+            return PATTERN_MATCH;
+        }
+    } else if(prog->well_formed && prog->prefix_len > 0) {
+        // Only the positions where the literal prefix occurs can start a match
+        const char* prefix = prog->prefix;
+        for(; (str = pattern_find_literal(str, last_start, prefix, prog->prefix_len)); str++) {
+            const char* res = pattern_match_start(ps, str, pattern);
+            if(res) {
+                ps->captures[0].data = str;
+                ps->captures[0].size = res - str;
+                return PATTERN_MATCH;
+            }
+        }
+    } else if(prog->well_formed && (prog->has_first_bytes || pattern_has_lead_run(prog))) {
+        const char* end = ps->data.data + ps->data.size;
+        while(str <= last_start) {
+            if(prog->has_first_bytes) {
+                while(str <= last_start && !pattern_byte_set_has(&prog->first_bytes, *str)) str++;
+                if(str > last_start) break;
+            }
+            const char* res = pattern_match_start(ps, str, pattern);
+            if(res) {
+                ps->captures[0].data = str;
+                ps->captures[0].size = res - str;
+                return PATTERN_MATCH;
+            }
+            // A failed start already tried the rest of the pattern after every split of its leading
+            // run, so no start inside the run can match either
+            const char* next = str + 1;
+            if(pattern_has_lead_run(prog)) {
+                const char* run_end =
+                    pattern_skip_item(ps->locale, str, end, prog->lead_item, prog->lead_item_end);
+                if(run_end >= next) next = run_end + 1;
+            }
+            str = next;
+        }
+    } else {
+        do {
+            const char* res = pattern_match_start(ps, str, pattern);
+            pattern_check_unclosed_captures(ps);
+            if(ps->error) return PATTERN_ERROR;
+            if(res) {
+                ps->captures[0].data = str;
+                ps->captures[0].size = res - str;
+                return PATTERN_MATCH;
+            }
+        } while(str++ < last_start);
+    }
+
+    return PATTERN_NO_MATCH;
+}
+
+// Searches for a match starting between offsets `start` and `last` (both inclusive). The
+// `lookahead` bytes following the data are only seen by `%f`.
+static Pattern_Status pattern_search(Pattern_State* ps, const Pattern_Program* prog,
+                                     const char* data, size_t len, size_t lookahead, size_t start,
+                                     size_t last) {
+    pattern_init(ps, data, len, prog->pattern);
+    ps->lookahead = lookahead;
+    ps->flags = prog->flags;
+    ps->locale = prog->locale;
+
+    const char* str = data + start;
+    const char* last_start = data + last;
+    // No errors can be raised by well-formed programs, so we are free to discard starting positions
+    if(prog->well_formed) {
+        if(!pattern_narrow_starts(prog, data, len, &str, &last_start)) return PATTERN_NO_MATCH;
+        if(!pattern_has_suffix(prog, data, len)) return PATTERN_NO_MATCH;
+    }
+    if(str > last_start) return PATTERN_NO_MATCH;
+
+    return pattern_match_starts(ps, prog, str, last_start);
+}
+
+// Returns true if the character at `pattern[i]` follows an escape, an odd run of `%`
+static bool pattern_is_escaped(const char* pattern, size_t i) {
+    size_t escapes = 0;
+    while(i > escapes && pattern[i - escapes - 1] == PATTERN_ESCAPE) escapes++;
+    return escapes % 2 == 1;
+}
+
+// Compares the literal characters before a trailing `$` with the end of `[str, end)`, scanning
+// the pattern backwards until an item that isn't plainly a literal. Returns false if they differ,
+// which only hints at a mismatch: the analysis of the pattern still has the last word.
+static bool pattern_may_end_with_suffix(const char* pattern, const char* str, const char* end) {
+    size_t i = strlen(pattern);
+    if(i == 0 || pattern[--i] != '$' || pattern_is_escaped(pattern, i)) return true;
+
+    size_t first = *pattern == '^';
+    while(i > first) {
+        char c = pattern[--i];
+        if(i >= 2 && pattern[i - 1] == 'b' && pattern_is_escaped(pattern, i - 1)) return true;
+        if(pattern_is_escaped(pattern, i)) {
+            if(isalnum((unsigned char)c)) return true;  // A class, `%b`, `%f` or a back-reference
+            i--;
+        } else if(strchr("*+-?.()[]%", c)) {
+            return true;
+        }
+        if(end == str || *--end != c) return false;
+    }
+    return true;
+}
+
+Pattern_Status pattern_match_ex(Pattern_State* ps, const void* data, size_t len,
+                                const char* pattern, ptrdiff_t starting_pos) {
+    if(starting_pos < 0) starting_pos += len;  // negative starting_pos start from end of string
+    assert(starting_pos >= 0 && (size_t)starting_pos <= len && "starting_pos out of bounds");
+
+    // One-shot matches leave the analysis to `pattern_compile`, except when the literal suffix of
+    // a trailing `$` is missing: analysing then rejects the data for well-formed patterns
+    Pattern_Program prog;
+    pattern_program_init(&prog, pattern, 0);
+    const char* str = (const char*)data;
+    if(!pattern_may_end_with_suffix(pattern, str + starting_pos, str + len)) {
+        pattern_analyze(&prog, pattern, 0);
+    }
+    return pattern_search(ps, &prog, str, len, 0, starting_pos, len);
+}
+
+Pattern_Status pattern_match_program_ex(Pattern_State* ps, const Pattern_Program* prog,
+                                        const void* data, size_t len, ptrdiff_t starting_pos) {
+    if(starting_pos < 0) starting_pos += len;  // negative starting_pos start from end of string
+    assert(starting_pos >= 0 && (size_t)starting_pos <= len && "starting_pos out of bounds");
+    return pattern_search(ps, prog, (const char*)data, len, 0, starting_pos, len);
+}
+
+Pattern_Status pattern_match_range(Pattern_State* ps, const Pattern_Program* prog,
+                                   const void* data, size_t len, size_t start, size_t end,
+                                   size_t max_scan) {
+    assert(start <= end && end <= len && "range out of bounds");
+    // The data seen by the matcher ends with the range, but begins with the buffer. `%f` still
+    // sees the byte following the range.
+    size_t last = max_scan < end - start ? start + max_scan : end;
+    return pattern_search(ps, prog, (const char*)data, end, end < len, start, last);
+}
+
+void pattern_set_init(Pattern_Set* set, Pattern_Set_Entry* entries, size_t* order,
+                      size_t capacity) {
+    set->entries = entries;
+    set->order = order;
+    set->count = 0;
+    set->capacity = capacity;
+    set->removed = 0;
+    set->reorder_interval = PATTERN_SET_REORDER_INTERVAL;
+    set->matches = 0;
+}
+
+size_t pattern_set_add(Pattern_Set* set, const char* pattern, int flags) {
+    pattern_set_compile_range(set, &pattern, flags, 0, 1);
+    return pattern_set_commit(set, 1);
+}
+
+void pattern_set_compile_range(const Pattern_Set* set, const char* const* patterns, int flags,
+                               size_t begin, size_t end) {
+    size_t room = set->capacity - set->count;
+    if(end > room) end = room;
+    for(size_t i = begin; i < end; i++) {
+        Pattern_Set_Entry* entry = &set->entries[set->count + i];
+        pattern_compile_ex(&entry->prog, patterns[i], flags);
+        entry->attempts = entry->hits = entry->cost = 0;
+        entry->removed = false;
+    }
+}
+
+size_t pattern_set_commit(Pattern_Set* set, size_t count) {
+    if(count > set->capacity - set->count) return PATTERN_SET_NONE;
+    size_t first = set->count;
+    for(size_t idx = first; idx < first + count; idx++) {
+        set->entries[idx].rank = idx;
+        set->order[idx] = idx;
+    }
+    set->count += count;
+    return first;
+}
+
+bool pattern_set_remove(Pattern_Set* set, size_t idx) {
+    if(idx >= set->count || set->entries[idx].removed) return false;
+    set->entries[idx].removed = true;
+    set->removed++;
+    return true;
+}
+
+size_t pattern_set_compact(Pattern_Set* set, size_t* remap) {
+    // Ranks are recomputed at the end, meanwhile they hold the new index of each pattern
+    size_t live = 0;
+    for(size_t i = 0; i < set->count; i++) {
+        Pattern_Set_Entry* entry = &set->entries[i];
+        entry->rank = entry->removed ? PATTERN_SET_NONE : live++;
+        if(remap) remap[i] = entry->rank;
+    }
+
+    size_t ranked = 0;
+    for(size_t i = 0; i < set->count; i++) {
+        size_t idx = set->entries[set->order[i]].rank;
+        if(idx != PATTERN_SET_NONE) set->order[ranked++] = idx;
+    }
+    // Patterns only move towards the start, over removed or already moved ones
+    for(size_t i = 0; i < set->count; i++) {
+        Pattern_Set_Entry* entry = &set->entries[i];
+        if(!entry->removed && entry->rank != i) set->entries[entry->rank] = *entry;
+    }
+
+    set->count = live;
+    set->removed = 0;
+    for(size_t i = 0; i < live; i++) set->entries[set->order[i]].rank = i;
+    return live;
+}
+
+// Whether the prefilters of `pattern_search` let the data through to the matcher
+static bool pattern_passes_prefilters(const Pattern_Program* prog, const char* data, size_t len) {
+    if(!prog->well_formed) return true;
+    const char* str = data;
+    const char* last_start = data + len;
+    return pattern_narrow_starts(prog, data, len, &str, &last_start) &&
+           pattern_has_suffix(prog, data, len);
+}
+
+// Verifies the patterns in declaration or learned order until one matches or raises an error
+static Pattern_Status pattern_set_verify(Pattern_Set* set, Pattern_State* ps, const char* data,
+                                         size_t len, bool learned, size_t* winner) {
+    bool learn = set->reorder_interval > 0;
+    Pattern_Status status = PATTERN_NO_MATCH;
+    *winner = PATTERN_SET_NONE;
+
+    for(size_t i = 0; i < set->count && status == PATTERN_NO_MATCH; i++) {
+        size_t idx = learned ? set->order[i] : i;
+        Pattern_Set_Entry* entry = &set->entries[idx];
+        if(entry->removed) continue;
+        bool passes = pattern_passes_prefilters(&entry->prog, data, len);
+        if(learn) {
+            entry->attempts++;
+            if(passes) entry->cost += len + 1;
+        }
+        if(!passes) continue;
+
+        status = pattern_search(ps, &entry->prog, data, len, 0, 0, len);
+        if(status != PATTERN_NO_MATCH) *winner = idx;
+    }
+
+    if(status == PATTERN_MATCH && learn) {
+        set->entries[*winner].hits++;
+        if(++set->matches >= set->reorder_interval) pattern_set_reorder(set);
+    }
+    return status;
+}
+
+Pattern_Status pattern_set_match(Pattern_Set* set, Pattern_State* ps, const void* data, size_t len,
+                                 size_t* winner) {
+    return pattern_set_verify(set, ps, (const char*)data, len, false, winner);
+}
+
+Pattern_Status pattern_set_match_any(Pattern_Set* set, Pattern_State* ps, const void* data,
+                                     size_t len, size_t* winner) {
+    return pattern_set_verify(set, ps, (const char*)data, len, true, winner);
+}
+
+// Whether pattern `a` comes before `b` in the learned order: patterns that won more often per byte
+// they cost come first, then the others in declaration order and the removed ones last
+static bool pattern_set_before(const Pattern_Set* set, size_t a, size_t b) {
+    const Pattern_Set_Entry* ea = &set->entries[a];
+    const Pattern_Set_Entry* eb = &set->entries[b];
+    if(ea->removed != eb->removed) return eb->removed;
+    // Each attempt costs at least one unit, even when rejected by the prefilters
+    double score_a = ea->hits ? (double)ea->hits / (double)(ea->cost + ea->attempts) : 0;
+    double score_b = eb->hits ? (double)eb->hits / (double)(eb->cost + eb->attempts) : 0;
+    return score_a != score_b ? score_a > score_b : a < b;
+}
+
+static void pattern_set_sift_down(Pattern_Set* set, size_t root, size_t count) {
+    size_t* order = set->order;
+    for(size_t child; (child = 2 * root + 1) < count; root = child) {
+        if(child + 1 < count && pattern_set_before(set, order[child], order[child + 1])) child++;
+        if(!pattern_set_before(set, order[root], order[child])) return;
+        size_t tmp = order[root];
+        order[root] = order[child];
+        order[child] = tmp;
+    }
+}
+
+void pattern_set_reorder(Pattern_Set* set) {
+    // Heapsort, the order being total the result doesn't depend on the previous one
+    size_t* order = set->order;
+    for(size_t i = set->count / 2; i-- > 0;) pattern_set_sift_down(set, i, set->count);
+    for(size_t end = set->count; end-- > 1;) {
+        size_t tmp = order[0];
+        order[0] = order[end];
+        order[end] = tmp;
+        pattern_set_sift_down(set, 0, end);
+    }
+    for(size_t i = 0; i < set->count; i++) set->entries[order[i]].rank = i;
+    set->matches = 0;
+}
+
+void pattern_set_export_order(const Pattern_Set* set, size_t* order) {
+    memcpy(order, set->order, set->count * sizeof(*order));
+}
+
+bool pattern_set_import_order(Pattern_Set* set, const size_t* order, size_t count) {
+    if(count != set->count) return false;
+
+    // Ranks mark the patterns already seen, then are restored if the order is invalid
+    for(size_t i = 0; i < count; i++) set->entries[i].rank = PATTERN_SET_NONE;
+    bool valid = true;
+    for(size_t i = 0; i < count && valid; i++) {
+        valid = order[i] < count && set->entries[order[i]].rank == PATTERN_SET_NONE;
+        if(valid) set->entries[order[i]].rank = i;
+    }
+
+    if(valid) memcpy(set->order, order, count * sizeof(*order));
+    for(size_t i = 0; i < count; i++) set->entries[set->order[i]].rank = i;
+    return valid;
+}
+
+#ifdef PATTERN_HAS_HANDLE
+void pattern_handle_init(Pattern_Handle* handle, void* value, Pattern_Reader* readers,
+                         size_t reader_count) {
+    handle->value = value;
+    handle->epoch = 0;
+    handle->readers = readers;
+    handle->reader_count = reader_count;
+    for(size_t i = 0; i < reader_count; i++) readers[i].epoch = 0;
+}
+
+void* pattern_handle_get(const Pattern_Handle* handle) {
+    return __atomic_load_n(&handle->value, __ATOMIC_ACQUIRE);
+}
+
+void pattern_handle_quiescent(Pattern_Handle* handle, size_t reader) {
+    // Seeing publication `n` means seeing its value: the epoch is incremented after the exchange
+    uint64_t epoch = __atomic_load_n(&handle->epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&handle->readers[reader].epoch, epoch, __ATOMIC_RELEASE);
+}
+
+void pattern_handle_offline(Pattern_Handle* handle, size_t reader) {
+    __atomic_store_n(&handle->readers[reader].epoch, UINT64_MAX, __ATOMIC_RELEASE);
+}
+
+void pattern_handle_online(Pattern_Handle* handle, size_t reader) {
+    uint64_t epoch = __atomic_load_n(&handle->epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&handle->readers[reader].epoch, epoch, __ATOMIC_RELAXED);
+    // The publisher must see the reader online before it gets a value, or it could reclaim it
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+uint64_t pattern_handle_publish(Pattern_Handle* handle, void* value, void** old) {
+    *old = __atomic_exchange_n(&handle->value, value, __ATOMIC_SEQ_CST);
+    return __atomic_add_fetch(&handle->epoch, 1, __ATOMIC_SEQ_CST);
+}
+
+bool pattern_handle_reclaimable(const Pattern_Handle* handle, uint64_t ticket) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for(size_t i = 0; i < handle->reader_count; i++) {
+        if(__atomic_load_n(&handle->readers[i].epoch, __ATOMIC_ACQUIRE) < ticket) return false;
+    }
+    return true;
+}
+#endif
+
+static void pattern_gsub_emit(Pattern_Gsub* gs, const char* str, size_t len) {
+    if(gs->out_len < gs->out_size) {
+        size_t room = gs->out_size - gs->out_len;
+        memcpy(gs->out + gs->out_len, str, len < room ? len : room);
+    }
+    gs->out_len += len;
+}
+
+static bool pattern_gsub_emit_repl(Pattern_State* ps, const char* repl, Pattern_Gsub* gs) {
+    const char* repl_ptr = repl;
+    while(*repl_ptr) {
+        const char* escape = strchr(repl_ptr, PATTERN_ESCAPE);
+        if(!escape) {
+            pattern_gsub_emit(gs, repl_ptr, strlen(repl_ptr));
+            break;
+        }
+        pattern_gsub_emit(gs, repl_ptr, escape - repl_ptr);
+
+        if(escape[1] == PATTERN_ESCAPE) {
+            pattern_gsub_emit(gs, escape, 1);
+        } else if(isdigit(escape[1])) {
+            // Like in Lua, `%1` is the whole match if the pattern has no captures
+            int capture = escape[1] - '0';
+            if(capture == 1 && ps->capture_count == 1) capture = 0;
+            if(capture >= ps->capture_count) {
+                ps->pattern_base = repl;
+                pattern_set_error(ps, PATTERN_ERR_INVALID_CAPTURE_IDX, escape - repl);
+                return false;
+            }
+
+            if(pattern_is_position_capture(ps, capture)) {
+                char pos[32];
+                int pos_len = snprintf(pos, sizeof(pos), "%zu",
+                                       pattern_get_capture_pos(ps, capture) + 1);
+                pattern_gsub_emit(gs, pos, pos_len);
+            } else {
+                pattern_gsub_emit(gs, ps->captures[capture].data, ps->captures[capture].size);
+            }
+        } else {
+            ps->pattern_base = repl;
+            pattern_set_error(ps, PATTERN_ERR_INVALID_REPLACEMENT, escape - repl);
+            return false;
+        }
+
+        repl_ptr = escape + 2;
+    }
+    return true;
+}
+
+void pattern_gsub_init(Pattern_Gsub* gs, char* out, size_t out_size, size_t pos) {
+    gs->out = out;
+    gs->out_size = out_size;
+    gs->out_len = 0;
+    gs->count = 0;
+    gs->pos = pos;
+    gs->after_match = false;
+}
+
+Pattern_Status pattern_gsub(Pattern_State* ps, const Pattern_Program* prog, const void* data,
+                            size_t len, const char* repl, Pattern_Gsub* gs) {
+    return pattern_gsub_range(ps, prog, data, len, len, repl, gs);
+}
+
+Pattern_Status pattern_gsub_range(Pattern_State* ps, const Pattern_Program* prog,
+                                  const void* data, size_t len, size_t end, const char* repl,
+                                  Pattern_Gsub* gs) {
+    assert(end <= len && "end out of bounds");
+    const char* str = (const char*)data;
+    size_t count = gs->count;
+
+    // Matches must start before `limit`. The empty match at the end of the data belongs to the
+    // last range.
+    size_t limit = end < len ? end : len + 1;
+    while(gs->pos < limit) {
+        // Anchored patterns can only match at the start of the data
+        if(prog->anchored && gs->pos != 0) break;
+
+        Pattern_Status status = pattern_search(ps, prog, str, len, 0, gs->pos, limit - 1);
+        if(status == PATTERN_ERROR) return PATTERN_ERROR;
+        if(status == PATTERN_NO_MATCH) break;
+
+        size_t match_start = ps->captures[0].data - str;
+        size_t match_end = match_start + ps->captures[0].size;
+        if(match_end == gs->pos && gs->after_match) {
+            // An empty match right after the previous one, skip a character instead (as Lua does)
+            if(gs->pos == len) break;
+            pattern_gsub_emit(gs, str + gs->pos, 1);
+            gs->pos++;
+            gs->after_match = false;
+            continue;
+        }
+
+        pattern_gsub_emit(gs, str + gs->pos, match_start - gs->pos);
+        if(!pattern_gsub_emit_repl(ps, repl, gs)) return PATTERN_ERROR;
+        gs->count++;
+        gs->pos = match_end;
+        gs->after_match = true;
+        if(prog->anchored) break;
+    }
+
+    if(gs->pos < end) {
+        pattern_gsub_emit(gs, str + gs->pos, end - gs->pos);
+        gs->pos = end;
+        gs->after_match = false;
+    }
+
+    return gs->count > count ? PATTERN_MATCH : PATTERN_NO_MATCH;
+}
+
+Pattern_Status pattern_match_lines(Pattern_State* ps, const Pattern_Program* prog,
+                                   const void* data, size_t len, size_t first_line,
+                                   Pattern_Line_Callback callback, void* userdata) {
+    Pattern_Status res = PATTERN_NO_MATCH;
+    const char* line = (const char*)data;
+    const char* end = line + len;
+
+    for(size_t line_no = first_line; line < end; line_no++) {
+        const char* newline = (const char*)memchr(line, '\n', end - line);
+        const char* line_end = newline ? newline : end;
+
+        switch(pattern_match_program(ps, prog, line, line_end - line)) {
+        case PATTERN_ERROR:
+            return PATTERN_ERROR;
+        case PATTERN_MATCH:
+            res = PATTERN_MATCH;
+            if(!callback(userdata, line_no, ps)) return res;
+            break;
+        case PATTERN_NO_MATCH:
+            break;
+        }
+
+        line = line_end + 1;
+    }
+
+    return res;
+}
+
+size_t pattern_count_newlines(const void* data, size_t len) {
+    // Short lines are counted a word at a time, but `memchr` finds sparse newlines faster. The
+    // length of the first lines tells which kind the data is made of.
+    const char* ptr = (const char*)data;
+    const char* end = ptr + len;
+    const char* sample_end = len > PATTERN_SWAR_SAMPLE ? ptr + PATTERN_SWAR_SAMPLE : end;
+    size_t count = pattern_count_byte(ptr, sample_end, '\n');
+    if(count >= PATTERN_SWAR_SAMPLE / PATTERN_SWAR_MAX_LINE) {
+        return count + pattern_count_byte(sample_end, end, '\n');
+    }
+    for(ptr = sample_end; (ptr = (const char*)memchr(ptr, '\n', end - ptr)); ptr++) count++;
+    return count;
+}
+
+size_t pattern_line_boundary(const void* data, size_t len, size_t pos) {
+    const char* str = (const char*)data;
+    if(pos == 0 || pos >= len || str[pos - 1] == '\n') return pos < len ? pos : len;
+    const char* newline = (const char*)memchr(str + pos, '\n', len - pos);
+    return newline ? (size_t)(newline - str) + 1 : len;
 }
 
 Pattern_Status pattern_match_cstr(Pattern_State* ps, const char* str, const char* pattern) {
@@ -613,8 +2789,16 @@ const char* pattern_strerror(Pattern_Error err) {
         return "invalid balanced pattern (expected %bxy)";
     case PATTERN_ERR_UNCLOSED_FRONTIER_PATTERN:
         return "unclosed frontier pattern (expected %f[set])";
+    case PATTERN_ERR_INVALID_REPLACEMENT:
+        return "invalid use of '%' in replacement string";
+    case PATTERN_ERR_INVALID_REPETITION:
+        return "invalid repetition bounds (expected {n}, {n,} or {n,m} with n <= m)";
+    case PATTERN_ERR_INVALID_ALTERNATION:
+        return "alternation only supports up to " PATTERN_STRINGIFY(PATTERN_MAX_ALTERNATIVES)
+               " literal sequences, as in (GET|POST)";
     }
     assert(false && "Unreachable");
+    return "unknown error";
 }
 
 void pattern_print_error(FILE* stream, const Pattern_State* ps) {
@@ -112,6 +112,9 @@ CTEST(pattern, start_anchor) {
     status = pattern_match_cstr(&ps, "12cantami123odiva", "^12");
     ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "12"));
     ASSERT_TRUE(ps.data.data == ps.captures[0].data);
+    status = pattern_match_cstr_ex(&ps, "ab12", "^12", 2);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "12"));
+    ASSERT_TRUE(pattern_get_capture_pos(&ps, 0) == 2);
 }
 
 CTEST(pattern, matches_and_operators) {
@@ -367,3 +370,804 @@ CTEST(pattern, frontier_errors) {
     pattern_print_error(stderr, &ps);
 }
 
+
+CTEST(pattern, compiled_programs) {
+    Pattern_State ps;
+    Pattern_Status status;
+    Pattern_Program prog;
+
+    pattern_compile(&prog, "(%w+)=(%d+)");
+    ASSERT_TRUE(prog.well_formed && !prog.anchored && !prog.end_anchored);
+    ASSERT_TRUE(prog.min_len == 3 && prog.max_len == PATTERN_UNBOUNDED);
+    status = pattern_match_program(&ps, &prog, "a=1", 3);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[1], "a"));
+    status = pattern_match_program_ex(&ps, &prog, "x=1 yy=22", 9, 2);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "yy=22"));
+
+    pattern_compile(&prog, "^%d%d?");
+    ASSERT_TRUE(prog.well_formed && prog.anchored && prog.min_len == 1 && prog.max_len == 2);
+
+    // Malformed patterns still compile, errors are reported while matching
+    pattern_compile(&prog, "(a");
+    ASSERT_FALSE(prog.well_formed);
+    pattern_compile(&prog, "(.)%2");
+    ASSERT_FALSE(prog.well_formed);
+    pattern_compile(&prog, "a[b");
+    ASSERT_FALSE(prog.well_formed);
+    status = pattern_match_program(&ps, &prog, "ab", 2);
+    ASSERT_TRUE(status == PATTERN_ERROR && ps.error == PATTERN_ERR_UNCLOSED_CLASS);
+}
+
+CTEST(pattern, end_anchored_suffix) {
+    Pattern_State ps;
+    Pattern_Status status;
+    Pattern_Program prog;
+
+    pattern_compile(&prog, "(.-)%.json$");
+    ASSERT_TRUE(prog.end_anchored && prog.suffix_len == 5 && memcmp(prog.suffix, ".json", 5) == 0);
+    pattern_compile(&prog, ";%s*$");
+    ASSERT_TRUE(prog.end_anchored && prog.suffix_len == 0);
+    pattern_compile(&prog, "a%$");
+    ASSERT_TRUE(!prog.end_anchored && prog.suffix_len == 0);
+    pattern_compile(&prog, "abcdefghijklmnopqrstuvwxyz$");
+    ASSERT_TRUE(prog.suffix_len == PATTERN_MAX_SUFFIX);
+
+    status = pattern_match_cstr(&ps, "server.log", "%.log$");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], ".log"));
+    status = pattern_match_cstr(&ps, "server.log.1", "%.log$");
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+    status = pattern_match_cstr(&ps, "log", "%.log$");
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+    status = pattern_match_cstr(&ps, "a.json.json", "(.-)%.json$");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[1], "a.json"));
+    status = pattern_match_cstr(&ps, "ab.json", "^(%a%a?)%.json$");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[1], "ab"));
+    status = pattern_match_cstr(&ps, "abc.json", "^(%a%a?)%.json$");
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+    status = pattern_match_cstr(&ps, "abc.json", "(%a%a?)%.json$");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[1], "bc"));
+    status = pattern_match_cstr(&ps, "x = 1;  ", ";%s*$");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], ";  "));
+    status = pattern_match_cstr_ex(&ps, "x.log", "%.log$", 2);
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+
+    // One-shot matches only trust a missing suffix for well-formed patterns
+    status = pattern_match_cstr(&ps, "x.txt", "[%.log$");
+    ASSERT_TRUE(status == PATTERN_ERROR && ps.error == PATTERN_ERR_UNCLOSED_CLASS);
+    status = pattern_match_cstr(&ps, "a$", "a%$");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "a$"));
+    status = pattern_match_cstr(&ps, "(x)", "%b()$");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "(x)"));
+    status = pattern_match_cstr(&ps, "(x)z", "%b()$");
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+    status = pattern_match_cstr(&ps, "name.c", "^n.-%.c$");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "name.c"));
+}
+
+CTEST(pattern, backreference_search) {
+    Pattern_State ps;
+    Pattern_Status status;
+
+    status = pattern_match_cstr(&ps, "this is is a test", "(%w+)%s+%1");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "is is"));
+    status = pattern_match_cstr(&ps, "abcdefabxab", "(..).-%1");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "abcdefab"));
+    status = pattern_match_cstr(&ps, "abcdefabxab", "(..).*%1");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "abcdefabxab"));
+    status = pattern_match_cstr(&ps, "abcdefgh", "(..).-%1");
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+    status = pattern_match_cstr(&ps, "ab ab;ab", "(%a+)[ ;]-%1$");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "ab;ab"));
+    status = pattern_match_cstr(&ps, "xyxy", "^(x)%a*%1");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "xyx"));
+    status = pattern_match_cstr(&ps, "aaa", "(a*)b*%1");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "aa"));
+}
+
+typedef struct {
+    char out[256];
+    size_t len;
+} Line_Results;
+
+static bool collect_line(void* userdata, size_t line, const Pattern_State* ps) {
+    Line_Results* res = (Line_Results*)userdata;
+    res->len += sprintf(res->out + res->len, "%zu:%.*s;", line, (int)ps->captures[0].size,
+                        ps->captures[0].data);
+    return true;
+}
+
+CTEST(pattern, lines) {
+    const char* text = "GET /a 200\nPOST /b 500\n\nGET /c 404\nPUT /d 500";
+    size_t len = strlen(text);
+    Pattern_State ps;
+    Pattern_Program prog;
+    pattern_compile(&prog, "%d+$");
+
+    Line_Results serial = {{0}, 0};
+    ASSERT_TRUE(pattern_match_lines(&ps, &prog, text, len, 1, collect_line, &serial) ==
+                PATTERN_MATCH);
+    ASSERT_STR("1:200;2:500;4:404;5:500;", serial.out);
+    ASSERT_EQUAL(4, pattern_count_newlines(text, len));
+
+    // Split in line-aligned chunks, number them with a prefix sum of their newlines and merge
+    // the per-chunk results in order: the output must be the same as the serial scan
+    size_t bounds[4] = {0, 0, 0, len};
+    bounds[1] = pattern_line_boundary(text, len, 5);
+    bounds[2] = pattern_line_boundary(text, len, 23);
+    ASSERT_EQUAL(11, bounds[1]);
+    ASSERT_EQUAL(23, bounds[2]);
+
+    Line_Results chunked = {{0}, 0};
+    size_t first_line = 1;
+    for(int i = 0; i < 3; i++) {
+        const char* chunk = text + bounds[i];
+        size_t chunk_len = bounds[i + 1] - bounds[i];
+        pattern_match_lines(&ps, &prog, chunk, chunk_len, first_line, collect_line, &chunked);
+        first_line += pattern_count_newlines(chunk, chunk_len);
+    }
+    ASSERT_STR(serial.out, chunked.out);
+
+    ASSERT_EQUAL(0, pattern_line_boundary(text, len, 0));
+    ASSERT_EQUAL(len, pattern_line_boundary(text, len, len - 1));
+
+    pattern_compile(&prog, "[");
+    ASSERT_TRUE(pattern_match_lines(&ps, &prog, text, len, 1, collect_line, &serial) ==
+                PATTERN_ERROR);
+}
+
+static bool gsub_eq(const char* str, const char* pattern, const char* repl, const char* expected) {
+    Pattern_State ps;
+    Pattern_Program prog;
+    Pattern_Gsub gs;
+    char out[256];
+    pattern_compile(&prog, pattern);
+    pattern_gsub_init(&gs, out, sizeof(out), 0);
+    if(pattern_gsub(&ps, &prog, str, strlen(str), repl, &gs) == PATTERN_ERROR) return false;
+    return gs.out_len == strlen(expected) && memcmp(out, expected, gs.out_len) == 0;
+}
+
+CTEST(pattern, gsub) {
+    ASSERT_TRUE(gsub_eq("hello world", "o", "0", "hell0 w0rld"));
+    ASSERT_TRUE(gsub_eq("hello world", "(%w+)", "<%1>", "<hello> <world>"));
+    ASSERT_TRUE(gsub_eq("hello world", "%w+", "%0 %0", "hello hello world world"));
+    ASSERT_TRUE(gsub_eq("hello world", "(%w+)%s*(%w+)", "%2 %1", "world hello"));
+    ASSERT_TRUE(gsub_eq("abc", "%w", "%1%%", "a%b%c%"));
+    ASSERT_TRUE(gsub_eq("abc def", "()%w", "%1", "123 567"));
+    ASSERT_TRUE(gsub_eq("abc", "", "-", "-a-b-c-"));
+    ASSERT_TRUE(gsub_eq("abc", "x*", "-", "-a-b-c-"));
+    ASSERT_TRUE(gsub_eq("abc", "%w*", "-", "-"));
+    ASSERT_TRUE(gsub_eq("", "x*", "-", "-"));
+    ASSERT_TRUE(gsub_eq("aaa", "^a", "b", "baa"));
+    ASSERT_TRUE(gsub_eq("aaa", "^x", "b", "aaa"));
+    ASSERT_TRUE(gsub_eq("a.log b.log", "%.log$", "", "a.log b"));
+
+    Pattern_State ps;
+    Pattern_Program prog;
+    Pattern_Gsub gs;
+    char out[4];
+    pattern_compile(&prog, "%d");
+    pattern_gsub_init(&gs, out, sizeof(out), 0);
+    ASSERT_TRUE(pattern_gsub(&ps, &prog, "a1b2c3", 6, "<%0>", &gs) == PATTERN_MATCH);
+    ASSERT_TRUE(gs.count == 3 && gs.out_len == 12 && memcmp(out, "a<1>", 4) == 0);
+
+    pattern_gsub_init(&gs, NULL, 0, 0);
+    ASSERT_TRUE(pattern_gsub(&ps, &prog, "a1", 2, "%2", &gs) == PATTERN_ERROR);
+    ASSERT_TRUE(ps.error == PATTERN_ERR_INVALID_CAPTURE_IDX && ps.error_loc == 0);
+    pattern_gsub_init(&gs, NULL, 0, 0);
+    ASSERT_TRUE(pattern_gsub(&ps, &prog, "a1", 2, "x%y", &gs) == PATTERN_ERROR);
+    ASSERT_TRUE(ps.error == PATTERN_ERR_INVALID_REPLACEMENT && ps.error_loc == 1);
+    pattern_print_error(stderr, &ps);
+}
+
+CTEST(pattern, gsub_chunks) {
+    const char* text = "key=value; other = thing;x=y;;  last=one";
+    const char* patterns[] = {"(%w+)%s*=%s*(%w+)", "%s*", ";%s*", "x*", "^key", "%f[%w]%w"};
+    size_t len = strlen(text);
+
+    for(size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        Pattern_State ps;
+        Pattern_Program prog;
+        pattern_compile(&prog, patterns[p]);
+
+        char serial[256];
+        Pattern_Gsub gs;
+        pattern_gsub_init(&gs, serial, sizeof(serial), 0);
+        pattern_gsub(&ps, &prog, text, len, "[%0]", &gs);
+        size_t serial_len = gs.out_len;
+
+        for(size_t chunk_size = 1; chunk_size < len; chunk_size++) {
+            // Each chunk is substituted independently, as if on its own thread
+            char chunk_out[64][256];
+            Pattern_Gsub chunks[64];
+            size_t chunk_count = 0;
+            for(size_t start = 0; start < len; start += chunk_size, chunk_count++) {
+                size_t end = start + chunk_size < len ? start + chunk_size : len;
+                pattern_gsub_init(&chunks[chunk_count], chunk_out[chunk_count], 256, start);
+                pattern_gsub_range(&ps, &prog, text, len, end, "[%0]", &chunks[chunk_count]);
+            }
+
+            // Stitch: a chunk that didn't start where its predecessor stopped is redone from there
+            char merged[256];
+            size_t merged_len = 0;
+            for(size_t i = 0; i < chunk_count; i++) {
+                size_t start = i * chunk_size;
+                size_t end = start + chunk_size < len ? start + chunk_size : len;
+                if(i > 0 && (chunks[i - 1].pos != start || chunks[i - 1].after_match)) {
+                    size_t pos = chunks[i - 1].pos;
+                    bool after_match = chunks[i - 1].after_match;
+                    pattern_gsub_init(&chunks[i], chunk_out[i], 256, pos);
+                    chunks[i].after_match = after_match;
+                    pattern_gsub_range(&ps, &prog, text, len, end, "[%0]", &chunks[i]);
+                }
+                memcpy(merged + merged_len, chunk_out[i], chunks[i].out_len);
+                merged_len += chunks[i].out_len;
+            }
+
+            ASSERT_EQUAL(serial_len, merged_len);
+            ASSERT_DATA((const unsigned char*)serial, serial_len, (const unsigned char*)merged,
+                        merged_len);
+        }
+    }
+}
+
+CTEST(pattern, fixed_length) {
+    Pattern_State ps;
+    Pattern_Status status;
+    Pattern_Program prog;
+
+    pattern_compile(&prog, "^(%d%d%d%d)%-(%d%d)%-%d%dT%d%d:%d%d$");
+    ASSERT_TRUE(prog.fixed_len == 16 && prog.fixed_set_count == 4);
+    status = pattern_match_program(&ps, &prog, "2025-01-31T12:59", 16);
+    ASSERT_TRUE(status == PATTERN_MATCH && ps.capture_count == 3);
+    ASSERT_TRUE(capture_eq(ps.captures[1], "2025") && capture_eq(ps.captures[2], "01"));
+    status = pattern_match_program(&ps, &prog, "2025-01-31T12:5x", 16);
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+    status = pattern_match_program(&ps, &prog, "2025-01-31T12:590", 17);
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+
+    pattern_compile(&prog, "%x%x%x%x%x%x%x%x%-%x%x%x%x%-");
+    ASSERT_TRUE(prog.fixed_len == 14 && prog.fixed_set_count == 2);
+    pattern_compile(&prog, "%d+");
+    ASSERT_TRUE(prog.fixed_len == 0);
+    pattern_compile(&prog, "%f[%d]%d");
+    ASSERT_TRUE(prog.fixed_len == 0);
+
+    // Long scans use the bit-parallel search
+    char data[1024];
+    memset(data, 'a', sizeof(data));
+    memcpy(data + 900, "ab12c", 5);
+    pattern_compile(&prog, "b(%d%d)");
+    status = pattern_match_program(&ps, &prog, data, sizeof(data));
+    ASSERT_TRUE(status == PATTERN_MATCH && pattern_get_capture_pos(&ps, 0) == 901);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "b12") && capture_eq(ps.captures[1], "12"));
+    pattern_compile(&prog, "b%d%d%a$");
+    status = pattern_match_program(&ps, &prog, data, sizeof(data));
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+    pattern_compile(&prog, "b%d%d%a");
+    status = pattern_match_program_ex(&ps, &prog, data, sizeof(data), 902);
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+}
+
+CTEST(pattern, idioms) {
+    Pattern_State ps;
+    Pattern_Status status;
+    Pattern_Program prog;
+
+    pattern_compile(&prog, "^%s*(.-)%s*$");
+    ASSERT_TRUE(prog.idiom == PATTERN_IDIOM_TRIM);
+    status = pattern_match_cstr(&ps, " \t hello  world \n ", "^%s*(.-)%s*$");
+    ASSERT_TRUE(status == PATTERN_MATCH && ps.capture_count == 2);
+    ASSERT_TRUE(capture_eq(ps.captures[0], " \t hello  world \n ") &&
+                capture_eq(ps.captures[1], "hello  world"));
+    status = pattern_match_cstr(&ps, "    ", "^%s*(.-)%s*$");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[1], ""));
+    ASSERT_TRUE(pattern_get_capture_pos(&ps, 1) == 4);
+
+    pattern_compile(&prog, "(%S+)");
+    ASSERT_TRUE(prog.idiom == PATTERN_IDIOM_CLASS_RUN);
+    status = pattern_match_cstr_ex(&ps, "  first second", "(%S+)", 9);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[1], "econd"));
+    status = pattern_match_cstr(&ps, "  --  ", "%w+");
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+    status = pattern_match_cstr(&ps, "x  ", "^[%s]+");
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+
+    pattern_compile(&prog, "%-?%d+%.?%d*");
+    ASSERT_TRUE(prog.idiom == PATTERN_IDIOM_NUMBER);
+    status = pattern_match_cstr(&ps, "x - -12.5.3", "%-?%d+%.?%d*");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "-12.5"));
+    status = pattern_match_cstr(&ps, "v7.", "%-?%d+%.?%d*");
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "7."));
+
+    pattern_compile(&prog, "(%w+)=(%w+)");
+    ASSERT_TRUE(prog.idiom == PATTERN_IDIOM_KEY_VALUE);
+    status = pattern_match_cstr(&ps, "a= b=; key=value=x", "(%w+)=(%w+)");
+    ASSERT_TRUE(status == PATTERN_MATCH && ps.capture_count == 3);
+    ASSERT_TRUE(capture_eq(ps.captures[1], "key") && capture_eq(ps.captures[2], "value"));
+    status = pattern_match_cstr(&ps, "a= =b", "(%w+)=(%w+)");
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+
+    pattern_compile(&prog, "%w+%d");
+    ASSERT_TRUE(prog.idiom == PATTERN_IDIOM_NONE);
+}
+
+static bool canonical_eq(const char* a, const char* b) {
+    return pattern_fingerprint(a) == pattern_fingerprint(b);
+}
+
+CTEST(pattern, canonical_form) {
+    char out[64];
+    ASSERT_TRUE(pattern_canonicalize("[0-9]+", out, sizeof(out)) == 3 && !strcmp(out, "%d+"));
+    ASSERT_TRUE(pattern_canonicalize("^[%a_][_%w]*$", out, sizeof(out)) == 13);
+    ASSERT_STR("^[%a_][%w_]*$", out);
+    ASSERT_TRUE(pattern_canonicalize("[^%s]%,[.][ba-f]", out, sizeof(out)) == 10);
+    ASSERT_STR("%S,%.[a-f]", out);
+    ASSERT_TRUE(pattern_canonicalize("[0-9a-fA-F]%f[^%-]", out, sizeof(out)) == 9);
+    ASSERT_STR("%x%f[^%-]", out);
+    ASSERT_TRUE(pattern_canonicalize("%d+", out, 3) == 3 && !strcmp(out, "%d"));
+    ASSERT_TRUE(pattern_canonicalize("[a", out, sizeof(out)) == 2 && !strcmp(out, "[a"));
+
+    ASSERT_TRUE(canonical_eq("%d", "[0-9]"));
+    ASSERT_TRUE(canonical_eq("[ab]", "[ba]"));
+    ASSERT_TRUE(canonical_eq("%,x", ",x"));
+    ASSERT_TRUE(canonical_eq("(%w+)%s*=%s*(%w+)", "([%w]+)[%s]*=[%s]*([%w]+)"));
+    ASSERT_FALSE(canonical_eq("%d+", "%d*"));
+    ASSERT_FALSE(canonical_eq("a.b", "a%.b"));
+    ASSERT_FALSE(canonical_eq("(a)%1", "(a)a"));
+
+    Pattern_Program a, b;
+    pattern_compile(&a, "[_%a][_%w]*");
+    pattern_compile(&b, "[%a_][%w_]*");
+    ASSERT_TRUE(a.fingerprint == b.fingerprint);
+}
+
+CTEST(pattern, counted_repetition) {
+    Pattern_State ps;
+    Pattern_Status status;
+    Pattern_Program prog;
+
+    pattern_compile_ex(&prog, "%d{4}%-%d{2}%-%d{2}", PATTERN_EXTENDED);
+    ASSERT_TRUE(prog.well_formed && prog.fixed_len == 10);
+    status = pattern_match_program(&ps, &prog, "on 2024-1-19, 2024-10-19.", 25);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "2024-10-19"));
+
+    pattern_compile_ex(&prog, "(a{2,3})(a*)", PATTERN_EXTENDED);
+    ASSERT_TRUE(prog.min_len == 2 && prog.max_len == PATTERN_UNBOUNDED);
+    status = pattern_match_program(&ps, &prog, "baaaa", 5);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[1], "aaa"));
+    ASSERT_TRUE(capture_eq(ps.captures[2], "a"));
+    status = pattern_match_program(&ps, &prog, "aba", 3);
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+
+    pattern_compile_ex(&prog, "^[ab]{1,3}b.{0,}$", PATTERN_EXTENDED);
+    status = pattern_match_program(&ps, &prog, "abbxyz", 6);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "abbxyz"));
+    status = pattern_match_program(&ps, &prog, "aaaab", 5);
+    ASSERT_TRUE(status == PATTERN_NO_MATCH);
+
+    // Braces not forming a repetition are literals, as they are without the extended syntax
+    pattern_compile_ex(&prog, "a{x}{2", PATTERN_EXTENDED);
+    status = pattern_match_program(&ps, &prog, "a{x}{2", 6);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "a{x}{2"));
+    pattern_compile(&prog, "a{2}");
+    status = pattern_match_program(&ps, &prog, "aa a{2}", 7);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "a{2}"));
+
+    pattern_compile_ex(&prog, "ab{3,2}", PATTERN_EXTENDED);
+    ASSERT_FALSE(prog.well_formed);
+    status = pattern_match_program(&ps, &prog, "abbb", 4);
+    ASSERT_TRUE(status == PATTERN_ERROR && ps.error == PATTERN_ERR_INVALID_REPETITION);
+    ASSERT_TRUE(ps.error_loc == 2);
+
+    Pattern_Program a, b;
+    pattern_compile_ex(&a, "[0-9]{0,1}x{1}y{1,}", PATTERN_EXTENDED);
+    pattern_compile_ex(&b, "%d?xy+", PATTERN_EXTENDED);
+    ASSERT_TRUE(a.fingerprint == b.fingerprint);
+    pattern_compile(&b, "[0-9]{0,1}x{1}y{1,}");
+    ASSERT_TRUE(a.fingerprint != b.fingerprint);
+}
+
+CTEST(pattern, literal_alternation) {
+    Pattern_State ps;
+    Pattern_Status status;
+    Pattern_Program prog;
+
+    pattern_compile_ex(&prog, "\"(GET|POST|PUT) ", PATTERN_EXTENDED);
+    ASSERT_TRUE(prog.well_formed && prog.min_len == 5 && prog.max_len == 6);
+    ASSERT_TRUE(prog.fixed_len == 0);
+    status = pattern_match_program(&ps, &prog, "\"PATCH /\" \"PUT /x", 17);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[1], "PUT"));
+    ASSERT_TRUE(pattern_get_capture_pos(&ps, 0) == 10);
+
+    // Alternatives are tried in order, backtracking into the next one if the rest doesn't match
+    pattern_compile_ex(&prog, "^(a|ab|abc)c$", PATTERN_EXTENDED);
+    status = pattern_match_program(&ps, &prog, "abcc", 4);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[1], "abc"));
+    pattern_compile_ex(&prog, "(|x|%|)(%d)", PATTERN_EXTENDED);
+    status = pattern_match_program(&ps, &prog, "|7", 2);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "|7"));
+    ASSERT_TRUE(capture_eq(ps.captures[2], "7"));
+
+    // Without the extended syntax, or outside of a group, `|` is a literal
+    pattern_compile(&prog, "(a|b)");
+    status = pattern_match_program(&ps, &prog, "b a|b", 5);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[1], "a|b"));
+    pattern_compile_ex(&prog, "a|b", PATTERN_EXTENDED);
+    status = pattern_match_program(&ps, &prog, "b a|b", 5);
+    ASSERT_TRUE(status == PATTERN_MATCH && capture_eq(ps.captures[0], "a|b"));
+
+    pattern_compile_ex(&prog, "x(a|%d+)", PATTERN_EXTENDED);
+    ASSERT_FALSE(prog.well_formed);
+    status = pattern_match_program(&ps, &prog, "xa", 2);
+    ASSERT_TRUE(status == PATTERN_ERROR && ps.error == PATTERN_ERR_INVALID_ALTERNATION);
+    ASSERT_TRUE(ps.error_loc == 1);
+
+    char canonical[32];
+    pattern_canonicalize("(%a|b)", canonical, sizeof(canonical));
+    ASSERT_STR("(%a|b)", canonical);
+    Pattern_Program a, b;
+    pattern_compile_ex(&a, "(%.|%,)", PATTERN_EXTENDED);
+    pattern_compile_ex(&b, "(%.|,)", PATTERN_EXTENDED);
+    ASSERT_TRUE(a.fingerprint == b.fingerprint);
+    pattern_compile_ex(&b, "(,|%.)", PATTERN_EXTENDED);
+    ASSERT_TRUE(a.fingerprint != b.fingerprint);
+}
+
+CTEST(pattern, pattern_set) {
+    Pattern_State ps;
+    Pattern_Status status;
+    Pattern_Set set;
+    Pattern_Set_Entry entries[4];
+    size_t order[4], winner;
+
+    pattern_set_init(&set, entries, order, 4);
+    set.reorder_interval = 8;
+    ASSERT_TRUE(pattern_set_add(&set, "^ERROR (%w+)", 0) == 0);
+    ASSERT_TRUE(pattern_set_add(&set, "^(%u+) ", 0) == 1);
+    ASSERT_TRUE(pattern_set_add(&set, "timeout$", 0) == 2);
+    ASSERT_TRUE(pattern_set_add(&set, "%d+", 0) == 3);
+    ASSERT_TRUE(pattern_set_add(&set, "x", 0) == PATTERN_SET_NONE);
+
+    // Mostly matched by the last pattern, which is learned to be the most likely winner
+    for(int i = 0; i < 16; i++) {
+        status = pattern_set_match(&set, &ps, "took 42ms", 9, &winner);
+        ASSERT_TRUE(status == PATTERN_MATCH && winner == 3 && capture_eq(ps.captures[0], "42"));
+    }
+    ASSERT_TRUE(set.order[0] == 3 && entries[3].rank == 0 && entries[3].hits == 16);
+    ASSERT_TRUE(set.order[1] == 0 && set.order[2] == 1 && set.order[3] == 2);
+    // The prefilters reject "timeout$" without running the matcher, at no cost
+    ASSERT_TRUE(entries[2].attempts == 16 && entries[2].cost == 0);
+
+    // `pattern_set_match_any` only verifies the learned winner
+    status = pattern_set_match_any(&set, &ps, "took 42ms", 9, &winner);
+    ASSERT_TRUE(status == PATTERN_MATCH && winner == 3 && entries[0].attempts == 16);
+    // The first pattern in declaration order wins, unless any pattern is accepted
+    status = pattern_set_match(&set, &ps, "ERROR disk 42 timeout", 21, &winner);
+    ASSERT_TRUE(status == PATTERN_MATCH && winner == 0 && capture_eq(ps.captures[1], "disk"));
+    status = pattern_set_match_any(&set, &ps, "ERROR disk 42 timeout", 21, &winner);
+    ASSERT_TRUE(status == PATTERN_MATCH && winner == 3);
+    status = pattern_set_match_any(&set, &ps, "WARN x", 6, &winner);
+    ASSERT_TRUE(status == PATTERN_MATCH && winner == 1 && capture_eq(ps.captures[1], "WARN"));
+    status = pattern_set_match(&set, &ps, "no digits", 9, &winner);
+    ASSERT_TRUE(status == PATTERN_NO_MATCH && winner == PATTERN_SET_NONE);
+
+    size_t learned[4];
+    pattern_set_export_order(&set, learned);
+    Pattern_Set restored;
+    Pattern_Set_Entry restored_entries[4];
+    size_t restored_order[4];
+    pattern_set_init(&restored, restored_entries, restored_order, 4);
+    for(int i = 0; i < 4; i++) pattern_set_add(&restored, entries[i].prog.pattern, 0);
+    ASSERT_TRUE(pattern_set_import_order(&restored, learned, 4));
+    ASSERT_TRUE(memcmp(restored_order, learned, sizeof(learned)) == 0);
+    ASSERT_TRUE(restored_entries[learned[1]].rank == 1);
+
+    size_t duplicate[4] = {3, 1, 1, 0};
+    ASSERT_FALSE(pattern_set_import_order(&restored, duplicate, 4));
+    ASSERT_FALSE(pattern_set_import_order(&restored, learned, 3));
+    ASSERT_TRUE(memcmp(restored_order, learned, sizeof(learned)) == 0);
+    ASSERT_TRUE(restored_entries[learned[1]].rank == 1);
+
+    // Malformed patterns only matter if they are verified before the winner
+    pattern_set_init(&set, entries, order, 4);
+    pattern_set_add(&set, "%a", 0);
+    pattern_set_add(&set, "(%d", 0);
+    status = pattern_set_match(&set, &ps, "a1", 2, &winner);
+    ASSERT_TRUE(status == PATTERN_MATCH && winner == 0);
+    status = pattern_set_match(&set, &ps, "1", 1, &winner);
+    ASSERT_TRUE(status == PATTERN_ERROR && winner == 1 && ps.error == PATTERN_ERR_UNCLOSED_CAPTURE);
+}
+
+CTEST(pattern, pattern_set_remove) {
+    Pattern_State ps;
+    Pattern_Status status;
+    Pattern_Set set;
+    Pattern_Set_Entry entries[4];
+    size_t order[4], remap[4], winner;
+
+    pattern_set_init(&set, entries, order, 4);
+    set.reorder_interval = 4;
+    pattern_set_add(&set, "^GET ", 0);
+    pattern_set_add(&set, "^POST ", 0);
+    pattern_set_add(&set, "^%u+ ", 0);
+    pattern_set_add(&set, "HTTP", 0);
+    for(int i = 0; i < 4; i++) pattern_set_match(&set, &ps, "POST /x", 7, &winner);
+    ASSERT_TRUE(set.order[0] == 1);
+
+    // Removed patterns are skipped, the others keep their index
+    ASSERT_TRUE(pattern_set_remove(&set, 1));
+    ASSERT_FALSE(pattern_set_remove(&set, 1));
+    ASSERT_FALSE(pattern_set_remove(&set, 4));
+    status = pattern_set_match(&set, &ps, "POST /x", 7, &winner);
+    ASSERT_TRUE(status == PATTERN_MATCH && winner == 2);
+    status = pattern_set_match_any(&set, &ps, "POST /x", 7, &winner);
+    ASSERT_TRUE(status == PATTERN_MATCH && winner == 2);
+    ASSERT_TRUE(pattern_set_add(&set, "x", 0) == PATTERN_SET_NONE);
+
+    // Compaction reclaims the room, the learned order still comes first
+    pattern_set_reorder(&set);
+    size_t learned[4];
+    pattern_set_export_order(&set, learned);
+    ASSERT_TRUE(learned[0] == 2 && learned[3] == 1);
+    ASSERT_TRUE(pattern_set_compact(&set, remap) == 3 && set.removed == 0);
+    ASSERT_TRUE(remap[0] == 0 && remap[1] == PATTERN_SET_NONE && remap[2] == 1 && remap[3] == 2);
+    ASSERT_TRUE(set.order[0] == 1 && entries[1].rank == 0 && entries[1].hits == 2);
+    ASSERT_STR(entries[2].prog.pattern, "HTTP");
+    ASSERT_TRUE(pattern_set_add(&set, "^PUT ", 0) == 3);
+    status = pattern_set_match(&set, &ps, "PUT /x HTTP/1.1", 15, &winner);
+    ASSERT_TRUE(status == PATTERN_MATCH && winner == 1);
+    status = pattern_set_match(&set, &ps, "get HTTP", 8, &winner);
+    ASSERT_TRUE(status == PATTERN_MATCH && winner == 2);
+}
+
+CTEST(pattern, pattern_set_compile_range) {
+    const char* patterns[] = {"^GET ", "%d+", "(%a+)=(%a+)", "x$", "[^ ]+"};
+    Pattern_Set added, ranged;
+    Pattern_Set_Entry added_entries[6], ranged_entries[6];
+    size_t added_order[6], ranged_order[6];
+
+    pattern_set_init(&added, added_entries, added_order, 6);
+    pattern_set_init(&ranged, ranged_entries, ranged_order, 6);
+    pattern_set_add(&added, "%s", 0);
+    pattern_set_add(&ranged, "%s", 0);
+    for(int i = 0; i < 5; i++) pattern_set_add(&added, patterns[i], 0);
+
+    // Ranges compiled in any order give the same set as adding the patterns one by one
+    pattern_set_compile_range(&ranged, patterns, 0, 3, 5);
+    pattern_set_compile_range(&ranged, patterns, 0, 0, 3);
+    ASSERT_TRUE(ranged.count == 1);
+    ASSERT_TRUE(pattern_set_commit(&ranged, 5) == 1 && ranged.count == 6);
+    for(int i = 0; i < 6; i++) {
+        ASSERT_STR(ranged_entries[i].prog.pattern, added_entries[i].prog.pattern);
+        ASSERT_TRUE(ranged_entries[i].prog.fingerprint == added_entries[i].prog.fingerprint);
+        ASSERT_TRUE(ranged_order[i] == added_order[i] && ranged_entries[i].rank == (size_t)i);
+    }
+
+    // Patterns beyond the capacity are left out
+    pattern_set_init(&ranged, ranged_entries, ranged_order, 2);
+    pattern_set_compile_range(&ranged, patterns, 0, 0, 5);
+    ASSERT_TRUE(pattern_set_commit(&ranged, 5) == PATTERN_SET_NONE && ranged.count == 0);
+    ASSERT_TRUE(pattern_set_commit(&ranged, 2) == 0 && ranged.count == 2);
+    ASSERT_STR(ranged_entries[1].prog.pattern, "%d+");
+}
+
+// Inputs long enough to be scanned a word at a time, with matches at every offset within a word
+CTEST(pattern, word_scans) {
+    Pattern_State ps;
+    Pattern_Program prog;
+    char data[64];
+
+    for(size_t i = 0; i < 40; i++) {
+        memset(data, 'x', sizeof(data));
+        memcpy(data + i, "k=\"v\"", 5);
+        pattern_compile(&prog, "k=\"(%w+)\"");  // Literal prefix `k="`
+        ASSERT_TRUE(pattern_match_program(&ps, &prog, data, sizeof(data)) == PATTERN_MATCH);
+        ASSERT_TRUE(ps.captures[0].data == data + i && capture_eq(ps.captures[1], "v"));
+
+        memset(data, '7', sizeof(data));
+        data[i + 10] = '(';
+        data[i + 20] = ')';
+        pattern_compile(&prog, "(%d+)(%b())(7*)");
+        ASSERT_TRUE(pattern_match_program(&ps, &prog, data, sizeof(data)) == PATTERN_MATCH);
+        ASSERT_TRUE(ps.captures[1].size == (ptrdiff_t)(i + 10) && ps.captures[2].size == 11);
+        ASSERT_TRUE(ps.captures[3].size == (ptrdiff_t)(sizeof(data) - i - 21));
+    }
+
+    // Dense and sparse newlines are counted differently
+    static char lines[3 * 4096];
+    memset(lines, 'a', sizeof(lines));
+    for(size_t i = 0; i < sizeof(lines); i += 10) lines[i] = '\n';
+    ASSERT_TRUE(pattern_count_newlines(lines, sizeof(lines)) == (sizeof(lines) + 9) / 10);
+    memset(lines, 'a', sizeof(lines));
+    for(size_t i = 5; i < sizeof(lines); i += 1000) lines[i] = '\n';
+    ASSERT_TRUE(pattern_count_newlines(lines, sizeof(lines)) == (sizeof(lines) - 5 + 999) / 1000);
+}
+
+CTEST(pattern, search_skips) {
+    Pattern_State ps;
+    Pattern_Program prog;
+
+    // Starts are skipped by their first byte
+    const char* numbers = "12 345 67.8";
+    pattern_compile(&prog, "%d+%.");
+    ASSERT_TRUE(prog.has_first_bytes);
+    ASSERT_TRUE(pattern_match_program(&ps, &prog, numbers, 11) == PATTERN_MATCH);
+    ASSERT_TRUE(ps.captures[0].data == numbers + 7 && capture_eq(ps.captures[0], "67."));
+    pattern_compile_ex(&prog, "(GET|POST) /", PATTERN_EXTENDED);
+    ASSERT_TRUE(prog.has_first_bytes);
+    ASSERT_TRUE(pattern_match_program(&ps, &prog, "xx POST /a", 10) == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "POST /"));
+    pattern_compile(&prog, "%b()");
+    ASSERT_TRUE(pattern_match_program(&ps, &prog, "x (a) y", 7) == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "(a)"));
+    pattern_compile(&prog, "%d*x");
+    ASSERT_FALSE(prog.has_first_bytes);
+
+    // Failed starts skip the run they started with
+    pattern_compile(&prog, "(%a+)%d");
+    ASSERT_TRUE(pattern_match_program(&ps, &prog, "abc def9", 8) == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[1], "def"));
+    pattern_compile(&prog, "a-b");
+    ASSERT_TRUE(pattern_match_program(&ps, &prog, "aaac aab", 8) == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "aab"));
+    ASSERT_TRUE(pattern_match(&ps, "   y   x", 8, "%s*x") == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "   x"));
+
+    // Except when a back-reference depends on where the run started
+    pattern_compile(&prog, "(a*)b%1");
+    ASSERT_TRUE(pattern_match_program(&ps, &prog, "aaba", 4) == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "aba"));
+}
+
+static bool glob_match(const char* glob, const char* str) {
+    Pattern_State ps;
+    Pattern_Program prog;
+    pattern_compile_ex(&prog, glob, PATTERN_GLOB);
+    return pattern_match_program(&ps, &prog, str, strlen(str)) == PATTERN_MATCH;
+}
+
+CTEST(pattern, glob) {
+    ASSERT_TRUE(glob_match("*.log.[0-9]*", "/var/log/app.log.3"));
+    ASSERT_TRUE(glob_match("*.log.[0-9]*", "/var/log/app.log.3.gz"));
+    ASSERT_FALSE(glob_match("*.log.[0-9]*", "/var/log/app.log"));
+    ASSERT_TRUE(glob_match("*/src/*/*.c", "/home/src/lib/a/b.c"));
+    ASSERT_FALSE(glob_match("*/src/*/*.c", "/home/src/b.c"));
+
+    // Whole inputs only
+    ASSERT_FALSE(glob_match("abc", "xabcx"));
+    ASSERT_TRUE(glob_match("", ""));
+    ASSERT_TRUE(glob_match("*", ""));
+    ASSERT_FALSE(glob_match("?", ""));
+
+    // Single bytes, sets and escapes
+    ASSERT_TRUE(glob_match("file?.[ch]", "file1.h"));
+    ASSERT_FALSE(glob_match("file?.[ch]", "file12.c"));
+    ASSERT_TRUE(glob_match("[!a-c]x", "dx"));
+    ASSERT_FALSE(glob_match("[^a-c]x", "bx"));
+    ASSERT_TRUE(glob_match("[]x]", "]"));
+    ASSERT_TRUE(glob_match("\\*.txt", "*.txt"));
+    ASSERT_FALSE(glob_match("\\*.txt", "a.txt"));
+    ASSERT_TRUE(glob_match("[ab", "[ab"));
+    ASSERT_TRUE(glob_match("%d(x)", "%d(x)"));
+
+    // Matches start at the starting position
+    Pattern_State ps;
+    Pattern_Program prog, other;
+    pattern_compile_ex(&prog, "*.c", PATTERN_GLOB);
+    ASSERT_TRUE(pattern_match_program_ex(&ps, &prog, "xxa.c", 5, 2) == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "a.c") && ps.capture_count == 1);
+
+    // Globs are fingerprinted as written, `%d` isn't a class
+    pattern_compile_ex(&prog, "%d", PATTERN_GLOB);
+    pattern_compile_ex(&other, "[0-9]", PATTERN_GLOB);
+    ASSERT_TRUE(prog.fingerprint != other.fingerprint);
+}
+
+CTEST(pattern, match_range) {
+    Pattern_State ps;
+    Pattern_Program prog;
+    const char* data = "foobar baz";
+
+    // `%f` sees the byte before the range, which a sub-span would hide
+    pattern_compile(&prog, "%f[%a]%a+");
+    ASSERT_TRUE(pattern_match(&ps, data + 3, 7, "%f[%a]%a+") == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "bar"));
+    ASSERT_TRUE(pattern_match_range(&ps, &prog, data, 10, 3, 10, PATTERN_UNBOUNDED) ==
+                PATTERN_MATCH);
+    ASSERT_TRUE(pattern_get_capture_pos(&ps, 0) == 7 && capture_eq(ps.captures[0], "baz"));
+
+    // It also sees the byte after the range, so a range ending inside a word doesn't end the word
+    pattern_compile(&prog, "%a+%f[%A]");
+    ASSERT_TRUE(pattern_match_range(&ps, &prog, data, 10, 0, 4, PATTERN_UNBOUNDED) ==
+                PATTERN_NO_MATCH);
+    ASSERT_TRUE(pattern_match_range(&ps, &prog, data, 10, 0, 6, PATTERN_UNBOUNDED) ==
+                PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "foobar"));
+    ASSERT_TRUE(pattern_match_range(&ps, &prog, data, 10, 8, 10, 0) == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "az"));
+
+    // `^` anchors at the start of the range and `$` at its end, which bounds matches
+    pattern_compile(&prog, "^bar");
+    ASSERT_TRUE(pattern_match_range(&ps, &prog, data, 10, 3, 10, 0) == PATTERN_MATCH);
+    pattern_compile(&prog, "^foo");
+    ASSERT_FALSE(pattern_match_range(&ps, &prog, data, 10, 3, 10, 0) == PATTERN_MATCH);
+    pattern_compile(&prog, "%a+$");
+    ASSERT_TRUE(pattern_match_range(&ps, &prog, data, 10, 1, 6, PATTERN_UNBOUNDED) ==
+                PATTERN_MATCH);
+    ASSERT_TRUE(pattern_get_capture_pos(&ps, 0) == 1 && capture_eq(ps.captures[0], "oobar"));
+
+    // Matches start at most `max_scan` bytes after the start
+    pattern_compile(&prog, "baz");
+    ASSERT_FALSE(pattern_match_range(&ps, &prog, data, 10, 0, 10, 6) == PATTERN_MATCH);
+    ASSERT_TRUE(pattern_match_range(&ps, &prog, data, 10, 0, 10, 7) == PATTERN_MATCH);
+    pattern_compile(&prog, "%a+");
+    ASSERT_TRUE(pattern_match_range(&ps, &prog, data, 10, 6, 10, 0) == PATTERN_NO_MATCH);
+}
+
+CTEST(pattern, locale_snapshot) {
+    Pattern_State ps;
+    Pattern_Program prog;
+    Pattern_Locale c_locale, latin1;
+
+    // The snapshot of the C locale classifies bytes like the ctype functions
+    pattern_locale_snapshot(&c_locale);
+    ASSERT_TRUE(c_locale.classes['7'] & (1 << ('d' - 'a')));
+    ASSERT_FALSE(c_locale.classes[0xe9] & (1 << ('a' - 'a')));
+    pattern_compile_locale(&prog, "(%w+)=(%w+)", 0, &c_locale);
+    ASSERT_TRUE(pattern_match_program(&ps, &prog, "  key=42", 8) == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[1], "key") && capture_eq(ps.captures[2], "42"));
+
+    // Matching follows the snapshot, here a Latin-1 locale where `é` is a lowercase letter
+    latin1 = c_locale;
+    latin1.classes[0xe9] |= 1 << ('a' - 'a') | 1 << ('l' - 'a') | 1 << ('w' - 'a');
+    pattern_compile_locale(&prog, "%a+", 0, &latin1);
+    ASSERT_TRUE(pattern_match_program(&ps, &prog, "1 caf\xe9!", 7) == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "caf\xe9"));
+    pattern_compile_locale(&prog, "%l%A", 0, &latin1);  // Fixed-length, sets built from the table
+    ASSERT_TRUE(prog.fixed_len == 2);
+    ASSERT_TRUE(pattern_match_program(&ps, &prog, "\xe9\xe9\xe9!", 4) == PATTERN_MATCH);
+    ASSERT_TRUE(ps.captures[0].data[0] == '\xe9' && ps.captures[0].data[1] == '!');
+    pattern_compile_locale(&prog, "%f[%w][%w_]+", 0, &latin1);
+    ASSERT_TRUE(pattern_match_program(&ps, &prog, "-\xe9t\xe9", 4) == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "\xe9t\xe9"));
+    pattern_compile(&prog, "%a+");
+    ASSERT_TRUE(pattern_match_program(&ps, &prog, "\xe9t\xe9", 3) == PATTERN_MATCH);
+    ASSERT_TRUE(capture_eq(ps.captures[0], "t"));
+}
+
+#ifdef PATTERN_HAS_HANDLE
+CTEST(pattern, handle) {
+    Pattern_State ps;
+    Pattern_Program v1, v2, v3;
+    Pattern_Reader readers[2];
+    Pattern_Handle handle;
+    void* old;
+
+    pattern_compile(&v1, "%d+");
+    pattern_compile(&v2, "%a+");
+    pattern_compile(&v3, "%s+");
+    pattern_handle_init(&handle, &v1, readers, 2);
+    Pattern_Program* prog = (Pattern_Program*)pattern_handle_get(&handle);
+    ASSERT_TRUE(pattern_match_program(&ps, prog, "ab12", 4) == PATTERN_MATCH);
+
+    // The old program stays valid until every reader has gone through a quiescent state
+    uint64_t ticket = pattern_handle_publish(&handle, &v2, &old);
+    ASSERT_TRUE(old == &v1 && pattern_handle_get(&handle) == &v2);
+    ASSERT_FALSE(pattern_handle_reclaimable(&handle, ticket));
+    pattern_handle_quiescent(&handle, 0);
+    ASSERT_FALSE(pattern_handle_reclaimable(&handle, ticket));
+    pattern_handle_quiescent(&handle, 1);
+    ASSERT_TRUE(pattern_handle_reclaimable(&handle, ticket));
+
+    // Offline readers don't hold values back, until they are online again
+    pattern_handle_offline(&handle, 1);
+    ticket = pattern_handle_publish(&handle, &v3, &old);
+    ASSERT_TRUE(old == &v2 && !pattern_handle_reclaimable(&handle, ticket));
+    pattern_handle_quiescent(&handle, 0);
+    ASSERT_TRUE(pattern_handle_reclaimable(&handle, ticket));
+    pattern_handle_online(&handle, 1);
+    ticket = pattern_handle_publish(&handle, &v1, &old);
+    pattern_handle_quiescent(&handle, 0);
+    ASSERT_FALSE(pattern_handle_reclaimable(&handle, ticket));
+}
+#endif